@@ -48,6 +48,22 @@
  *
  * gzdec decompress gzip streams
  *
+ * The type of the decoded data is found from its first 4 KiB and the
+ * original file name of the gzip header, and set as src caps, so gzdec
+ * can be autoplugged by decodebin. Archive entries are typefound one by
+ * one, new caps are pushed when an entry differs from the previous one.
+ *
+ * Zip archives are detected from their first local file header and the
+ * stored and deflated entries are extracted, each one after a tag event
+ * with its name. Use entry-filter or entry to extract only some of them.
+ * When upstream is seekable in pull mode, the central directory is read
+ * first and only the selected entries are pulled; otherwise the archive is
+ * extracted in a single streaming pass.
+ *
+ * Plain gzip/zlib streams can also be decoded on demand: when upstream
+ * supports seekable pull mode, downstream can pull decoded ranges from the
+ * src pad and only the data up to the requested ranges is decoded.
+ *
  * <refsect2>
  * <title>Example launch line</title>
  * |[
@@ -56,16 +72,93 @@
  * </refsect2>
  */
 
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE           /* memrchr */
+#endif
+
 #ifdef HAVE_CONFIG_H
 #  include <config.h>
 #endif
 
+#include <string.h>
+
+#if defined (HAVE_MEMFD_CREATE) && defined (HAVE_GST_ALLOCATORS)
+#  define GZDEC_HAVE_MEMFD
+#  include <errno.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#  include <gst/allocators/gstfdmemory.h>
+#endif
+
 #include "zlib.h"
 
 #include <gst/gst.h>
+#include <gst/base/gsttypefindhelper.h>
 
 #include "gstgzdec.h"
 
+/* Default output chunk size */
+#define GZDEC_CHUNK_SIZE 16384
+/* output chunks are sliced out of memfd blocks of this size. Their pages
+ * are only allocated when written, so big blocks just save file
+ * descriptors */
+#define GZDEC_MEMFD_BLOCK_SIZE (4 << 20)
+/* memfd blocks alive in the process at most, each one holds a file
+ * descriptor until downstream releases its last slice */
+#define GZDEC_MEMFD_MAX_BLOCKS 256
+
+#define ZIP_LOCAL_HEADER_SIG 0x04034b50
+#define ZIP_DATA_DESCRIPTOR_SIG 0x08074b50
+#define ZIP_CENTRAL_DIRECTORY_SIG 0x02014b50
+#define ZIP_END_OF_CENTRAL_DIRECTORY_SIG 0x06054b50
+#define ZIP64_END_OF_CENTRAL_DIRECTORY_SIG 0x06064b50
+#define ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIG 0x07064b50
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_CENTRAL_DIRECTORY_SIZE 46
+#define ZIP_END_OF_CENTRAL_DIRECTORY_SIZE 22
+#define ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE 56
+#define ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE 20
+#define ZIP_FLAG_ENCRYPTED (1 << 0)
+#define ZIP_FLAG_DATA_DESCRIPTOR (1 << 3)
+#define ZIP_FLAG_UTF8 (1 << 11)
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATE 8
+
+/* bigger central directories are considered corrupted */
+#define GZDEC_ZIP_MAX_DIRECTORY (64 << 20)
+
+/* compressed data pulled from upstream at once in pull mode */
+#define GZDEC_PULL_BLOCK_SIZE 65536
+/* decoded data kept before the last requested range in pull mode */
+#define GZDEC_PULL_CACHE_SIZE (1 << 20)
+/* decoded bytes between inflate state checkpoints in pull mode */
+#define GZDEC_CHECKPOINT_SPACING (4 << 20)
+
+/* decoded data looked at to find its type */
+#define GZDEC_TYPEFIND_SIZE 4096
+
+#define TAR_BLOCK_SIZE 512
+/* bigger GNU long names or pax headers are considered corrupted */
+#define TAR_MAX_LONG_HEADER (1 << 20)
+
+/* Static USDT probes for the decode hot path. They compile to a single nop
+ * when not traced, and to nothing at all when sys/sdt.h is not available.
+ * Every probe gets the element pointer as first argument so that tracers
+ * can aggregate per instance, e.g.:
+ *
+ *   bpftrace -e 'usdt:libgstgzdec.so:gzdec:inflate__enter { @s[arg0] = nsecs; }
+ *     usdt:libgstgzdec.so:gzdec:inflate__return /@s[arg0]/ {
+ *     @inflate_ns[arg0] = hist(nsecs - @s[arg0]); delete(@s[arg0]); }'
+ */
+#ifdef HAVE_SYS_SDT_H
+#  include <sys/sdt.h>
+#  define GZDEC_PROBE2(name, a, b) DTRACE_PROBE2 (gzdec, name, a, b)
+#  define GZDEC_PROBE3(name, a, b, c) DTRACE_PROBE3 (gzdec, name, a, b, c)
+#else
+#  define GZDEC_PROBE2(name, a, b) G_STMT_START { } G_STMT_END
+#  define GZDEC_PROBE3(name, a, b, c) G_STMT_START { } G_STMT_END
+#endif
+
 GST_DEBUG_CATEGORY_STATIC (gst_gzdec_debug);
 #define GST_CAT_DEFAULT gst_gzdec_debug
 
@@ -79,9 +172,33 @@ enum
 enum
 {
   PROP_0,
-  PROP_SILENT
+  PROP_SILENT,
+  PROP_RECORD_DELIMITER,
+  PROP_TAR,
+  PROP_ENTRY_FILTER,
+  PROP_ENTRY,
+  PROP_MEMFD,
+  PROP_PASSTHROUGH_UNCOMPRESSED,
+  PROP_DICTIONARIES
 };
 
+#define DEFAULT_RECORD_DELIMITER -1
+#define DEFAULT_TAR FALSE
+#define DEFAULT_ENTRY_FILTER NULL
+#define DEFAULT_ENTRY NULL
+#define DEFAULT_MEMFD FALSE
+#define DEFAULT_PASSTHROUGH_UNCOMPRESSED FALSE
+#define DEFAULT_DICTIONARIES NULL
+
+#ifdef GZDEC_HAVE_MEMFD
+static gint memfd_blocks = 0;
+#endif
+
+/* preset dictionaries loaded by any instance, by zlib DICTID. They are
+ * never modified once registered, so they are shared read-only */
+static GMutex dictionaries_lock;
+static GHashTable *dictionaries = NULL;
+
 /* the capabilities of the inputs and outputs.
  *
  * describe the real formats here.
@@ -101,7 +218,7 @@ static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
 #define gst_gzdec_parent_class parent_class
 G_DEFINE_TYPE (Gstgzdec, gst_gzdec, GST_TYPE_ELEMENT);
 
-GST_ELEMENT_REGISTER_DEFINE (gzdec, "gzdec", GST_RANK_NONE,
+GST_ELEMENT_REGISTER_DEFINE (gzdec, "gzdec", GST_RANK_MARGINAL,
     GST_TYPE_GZDEC);
 
 static void gst_gzdec_set_property (GObject * object,
@@ -109,10 +226,32 @@ static void gst_gzdec_set_property (GObject * object,
 static void gst_gzdec_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec);
 
+static void gst_gzdec_finalize (GObject * object);
+
 static gboolean gst_gzdec_sink_event (GstPad * pad,
     GstObject * parent, GstEvent * event);
 static GstFlowReturn gst_gzdec_chain (GstPad * pad,
     GstObject * parent, GstBuffer * buf);
+static GstFlowReturn gst_gzdec_push (Gstgzdec * filter, GstBuffer * outbuf);
+static GstFlowReturn gst_gzdec_push_held (Gstgzdec * filter, gboolean force);
+static GstFlowReturn gst_gzdec_flush_records (Gstgzdec * filter);
+static GstFlowReturn gst_gzdec_detect (Gstgzdec * filter, gboolean eos);
+
+static gboolean gst_gzdec_sink_activate (GstPad * pad, GstObject * parent);
+static gboolean gst_gzdec_sink_activate_mode (GstPad * pad,
+    GstObject * parent, GstPadMode mode, gboolean active);
+static gboolean gst_gzdec_src_activate_mode (GstPad * pad,
+    GstObject * parent, GstPadMode mode, gboolean active);
+static GstFlowReturn gst_gzdec_src_getrange (GstPad * pad,
+    GstObject * parent, guint64 offset, guint length, GstBuffer ** buffer);
+static gboolean gst_gzdec_src_query (GstPad * pad,
+    GstObject * parent, GstQuery * query);
+static gboolean gst_gzdec_src_event (GstPad * pad,
+    GstObject * parent, GstEvent * event);
+static void gst_gzdec_checkpoint_free (GzdecCheckpoint * point);
+static void gst_gzdec_block_release (Gstgzdec * filter);
+static void gst_gzdec_inflate_end (Gstgzdec * filter);
+static void gst_gzdec_clear_held (Gstgzdec * filter);
 
 /* GObject vmethod implementations */
 
@@ -128,14 +267,66 @@ gst_gzdec_class_init (GstgzdecClass * klass)
 
   gobject_class->set_property = gst_gzdec_set_property;
   gobject_class->get_property = gst_gzdec_get_property;
+  gobject_class->finalize = gst_gzdec_finalize;
 
   g_object_class_install_property (gobject_class, PROP_SILENT,
       g_param_spec_boolean ("silent", "Silent", "Produce verbose output ?",
           TRUE, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_RECORD_DELIMITER,
+      g_param_spec_int ("record-delimiter", "Record delimiter",
+          "Cut every output buffer after the last occurrence of this byte "
+          "(e.g. 10 for newline delimited records) and carry the rest over "
+          "to the next buffer. Buffers of whole records are flagged with "
+          "GST_BUFFER_FLAG_MARKER. -1 disables it",
+          -1, G_MAXUINT8, DEFAULT_RECORD_DELIMITER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_TAR,
+      g_param_spec_boolean ("tar", "Tar",
+          "Demux the decoded data of gzip/zlib streams as a tar archive. "
+          "The content of every regular file is pushed after a tag event "
+          "with its name as title",
+          DEFAULT_TAR, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ENTRY_FILTER,
+      g_param_spec_string ("entry-filter", "Entry filter",
+          "Glob pattern of the archive entries to extract, all of them "
+          "when NULL", DEFAULT_ENTRY_FILTER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ENTRY,
+      g_param_spec_string ("entry", "Entry",
+          "Name of the only archive entry to extract, all the entries "
+          "matching entry-filter when NULL", DEFAULT_ENTRY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MEMFD,
+      g_param_spec_boolean ("memfd", "memfd",
+          "Decode into memfd backed memory, which can be passed by fd to "
+          "other processes (e.g. with unixfdsink) without copying. Ignored "
+          "when memfd is not supported",
+          DEFAULT_MEMFD, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_PASSTHROUGH_UNCOMPRESSED,
+      g_param_spec_boolean ("passthrough-uncompressed",
+          "Passthrough uncompressed",
+          "Forward the input untouched when it is not gzip, zlib or zip "
+          "data instead of failing",
+          DEFAULT_PASSTHROUGH_UNCOMPRESSED,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DICTIONARIES,
+      g_param_spec_string ("dictionaries", "Dictionaries",
+          "List of files with preset dictionaries for zlib streams, "
+          "separated by '" G_SEARCHPATH_SEPARATOR_S "'. They are registered "
+          "for all the instances and picked by the DICTID of the stream",
+          DEFAULT_DICTIONARIES, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   gst_element_class_set_details_simple (gstelement_class,
       "gzdec",
-      "Plugin to decompress gzip files",
+      "Codec/Decoder",
       "Plugin to decompress gzip files", "Diego Nieto <diego.nieto.m@outlook.com>");
 
   gst_element_class_add_pad_template (gstelement_class,
@@ -157,17 +348,152 @@ gst_gzdec_init (Gstgzdec * filter)
       GST_DEBUG_FUNCPTR (gst_gzdec_sink_event));
   gst_pad_set_chain_function (filter->sinkpad,
       GST_DEBUG_FUNCPTR (gst_gzdec_chain));
-  GST_PAD_SET_PROXY_CAPS (filter->sinkpad);
+  gst_pad_set_activate_function (filter->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_gzdec_sink_activate));
+  gst_pad_set_activatemode_function (filter->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_gzdec_sink_activate_mode));
   gst_element_add_pad (GST_ELEMENT (filter), filter->sinkpad);
 
   filter->srcpad = gst_pad_new_from_static_template (&src_factory, "src");
-  GST_PAD_SET_PROXY_CAPS (filter->srcpad);
+  gst_pad_set_activatemode_function (filter->srcpad,
+      GST_DEBUG_FUNCPTR (gst_gzdec_src_activate_mode));
+  gst_pad_set_getrange_function (filter->srcpad,
+      GST_DEBUG_FUNCPTR (gst_gzdec_src_getrange));
+  gst_pad_set_query_function (filter->srcpad,
+      GST_DEBUG_FUNCPTR (gst_gzdec_src_query));
+  gst_pad_set_event_function (filter->srcpad,
+      GST_DEBUG_FUNCPTR (gst_gzdec_src_event));
   gst_element_add_pad (GST_ELEMENT (filter), filter->srcpad);
 
   filter->silent = TRUE;
   filter->initialized = FALSE;
   filter->input_bytes = 0;
   filter->output_bytes = 0;
+  filter->record_delimiter = DEFAULT_RECORD_DELIMITER;
+  filter->record_tail = NULL;
+  filter->record_split = FALSE;
+  filter->tar = DEFAULT_TAR;
+  filter->entry_filter = DEFAULT_ENTRY_FILTER;
+  filter->entry_pattern = NULL;
+  filter->entry = DEFAULT_ENTRY;
+  filter->tar_adapter = gst_adapter_new ();
+  filter->tar_state = GZDEC_TAR_HEADER;
+  filter->tar_long_name = NULL;
+  filter->format = GZDEC_FORMAT_UNKNOWN;
+  filter->detect_adapter = gst_adapter_new ();
+  filter->zip_adapter = gst_adapter_new ();
+  filter->zip_state = GZDEC_ZIP_HEADER;
+  filter->memfd = DEFAULT_MEMFD;
+  filter->passthrough_uncompressed = DEFAULT_PASSTHROUGH_UNCOMPRESSED;
+  filter->dictionaries = DEFAULT_DICTIONARIES;
+  g_queue_init (&filter->typefind_held);
+  filter->typefind_size = 0;
+  filter->typefind_tried = 0;
+  filter->pull_cache = gst_adapter_new ();
+  filter->checkpoints = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gst_gzdec_checkpoint_free);
+#ifdef GZDEC_HAVE_MEMFD
+  filter->fd_allocator = gst_fd_allocator_new ();
+#else
+  filter->fd_allocator = NULL;
+#endif
+  filter->block = NULL;
+  filter->block_data = NULL;
+}
+
+static void
+gst_gzdec_finalize (GObject * object)
+{
+  Gstgzdec *filter = GST_GZDEC (object);
+
+  gst_clear_buffer (&filter->record_tail);
+  g_object_unref (filter->tar_adapter);
+  g_object_unref (filter->detect_adapter);
+  g_object_unref (filter->zip_adapter);
+  gst_gzdec_inflate_end (filter);
+  gst_gzdec_block_release (filter);
+  gst_clear_object (&filter->fd_allocator);
+  g_object_unref (filter->pull_cache);
+  g_ptr_array_unref (filter->checkpoints);
+  gst_gzdec_clear_held (filter);
+  g_free (filter->entry_name);
+  gst_clear_event (&filter->pending_segment);
+  gst_clear_event (&filter->pending_tags);
+  g_clear_pointer (&filter->zip_entries, g_array_unref);
+  g_free (filter->tar_long_name);
+  g_free (filter->entry_filter);
+  g_free (filter->entry);
+  g_free (filter->dictionaries);
+  if (filter->entry_pattern)
+    g_pattern_spec_free (filter->entry_pattern);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_gzdec_load_dictionaries (Gstgzdec * filter, const gchar * paths)
+{
+  gchar **files;
+  guint i;
+
+  if (!paths)
+    return;
+
+  files = g_strsplit (paths, G_SEARCHPATH_SEPARATOR_S, -1);
+  for (i = 0; files[i]; i++) {
+    GError *err = NULL;
+    gchar *contents;
+    gsize len;
+    guint32 id;
+
+    if (files[i][0] == '\0')
+      continue;
+
+    if (!g_file_get_contents (files[i], &contents, &len, &err)) {
+      GST_WARNING_OBJECT (filter, "Unable to load dictionary: %s",
+          err->message);
+      g_clear_error (&err);
+      continue;
+    }
+
+    id = adler32 (adler32 (0L, Z_NULL, 0), (const Bytef *) contents, len);
+    GST_INFO_OBJECT (filter, "Dictionary %s has DICTID 0x%08x", files[i], id);
+
+    g_mutex_lock (&dictionaries_lock);
+    if (!dictionaries)
+      dictionaries = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+          NULL, (GDestroyNotify) g_bytes_unref);
+    if (!g_hash_table_contains (dictionaries, GUINT_TO_POINTER (id)))
+      g_hash_table_insert (dictionaries, GUINT_TO_POINTER (id),
+          g_bytes_new_take (contents, len));
+    else
+      g_free (contents);
+    g_mutex_unlock (&dictionaries_lock);
+  }
+  g_strfreev (files);
+}
+
+/* the stream needs the dictionary its header asked for */
+static gboolean
+gst_gzdec_set_dictionary (Gstgzdec * filter)
+{
+  guint32 id = filter->strm.adler;
+  GBytes *dictionary = NULL;
+  gconstpointer data;
+  gsize size;
+
+  g_mutex_lock (&dictionaries_lock);
+  if (dictionaries)
+    dictionary = g_hash_table_lookup (dictionaries, GUINT_TO_POINTER (id));
+  g_mutex_unlock (&dictionaries_lock);
+
+  if (!dictionary) {
+    GST_WARNING_OBJECT (filter, "No dictionary with DICTID 0x%08x", id);
+    return FALSE;
+  }
+
+  data = g_bytes_get_data (dictionary, &size);
+  return inflateSetDictionary (&filter->strm, data, size) == Z_OK;
 }
 
 static void
@@ -180,6 +506,37 @@ gst_gzdec_set_property (GObject * object, guint prop_id,
     case PROP_SILENT:
       filter->silent = g_value_get_boolean (value);
       break;
+    case PROP_RECORD_DELIMITER:
+      filter->record_delimiter = g_value_get_int (value);
+      break;
+    case PROP_TAR:
+      filter->tar = g_value_get_boolean (value);
+      break;
+    case PROP_PASSTHROUGH_UNCOMPRESSED:
+      filter->passthrough_uncompressed = g_value_get_boolean (value);
+      break;
+    case PROP_DICTIONARIES:
+      g_free (filter->dictionaries);
+      filter->dictionaries = g_value_dup_string (value);
+      gst_gzdec_load_dictionaries (filter, filter->dictionaries);
+      break;
+    case PROP_MEMFD:
+      filter->memfd = g_value_get_boolean (value);
+      if (filter->memfd && !filter->fd_allocator)
+        GST_WARNING_OBJECT (filter, "memfd is not supported, ignoring it");
+      break;
+    case PROP_ENTRY_FILTER:
+      g_free (filter->entry_filter);
+      if (filter->entry_pattern)
+        g_pattern_spec_free (filter->entry_pattern);
+      filter->entry_filter = g_value_dup_string (value);
+      filter->entry_pattern = filter->entry_filter ?
+          g_pattern_spec_new (filter->entry_filter) : NULL;
+      break;
+    case PROP_ENTRY:
+      g_free (filter->entry);
+      filter->entry = g_value_dup_string (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -196,6 +553,27 @@ gst_gzdec_get_property (GObject * object, guint prop_id,
     case PROP_SILENT:
       g_value_set_boolean (value, filter->silent);
       break;
+    case PROP_RECORD_DELIMITER:
+      g_value_set_int (value, filter->record_delimiter);
+      break;
+    case PROP_TAR:
+      g_value_set_boolean (value, filter->tar);
+      break;
+    case PROP_PASSTHROUGH_UNCOMPRESSED:
+      g_value_set_boolean (value, filter->passthrough_uncompressed);
+      break;
+    case PROP_DICTIONARIES:
+      g_value_set_string (value, filter->dictionaries);
+      break;
+    case PROP_MEMFD:
+      g_value_set_boolean (value, filter->memfd);
+      break;
+    case PROP_ENTRY_FILTER:
+      g_value_set_string (value, filter->entry_filter);
+      break;
+    case PROP_ENTRY:
+      g_value_set_string (value, filter->entry);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -204,6 +582,76 @@ gst_gzdec_get_property (GObject * object, guint prop_id,
 
 /* GstElement vmethod implementations */
 
+/* free the inflate state, if any */
+static void
+gst_gzdec_inflate_end (Gstgzdec * filter)
+{
+  if (!filter->initialized)
+    return;
+
+  inflateEnd (&filter->strm);
+  filter->initialized = FALSE;
+}
+
+/* get ready for a new stream */
+static void
+gst_gzdec_reset (Gstgzdec * filter)
+{
+  int ret;
+
+  gst_clear_buffer (&filter->record_tail);
+  filter->record_split = FALSE;
+  gst_adapter_clear (filter->tar_adapter);
+  filter->tar_state = GZDEC_TAR_HEADER;
+  g_clear_pointer (&filter->tar_long_name, g_free);
+  filter->format = GZDEC_FORMAT_UNKNOWN;
+  gst_adapter_clear (filter->detect_adapter);
+  gst_adapter_clear (filter->zip_adapter);
+  filter->zip_state = GZDEC_ZIP_HEADER;
+  g_clear_pointer (&filter->zip_entries, g_array_unref);
+  filter->zip_entry_index = 0;
+  filter->caps_sent = FALSE;
+  gst_gzdec_clear_held (filter);
+  g_clear_pointer (&filter->entry_name, g_free);
+  gst_clear_event (&filter->pending_segment);
+  gst_clear_event (&filter->pending_tags);
+  filter->strm.zalloc = Z_NULL;
+  filter->strm.zfree = Z_NULL;
+  filter->strm.opaque = Z_NULL;
+  filter->strm.avail_in = 0;
+  filter->strm.next_in = Z_NULL;
+  gst_gzdec_inflate_end (filter);
+  /* 15 zlib fomat, 32 zlib and gzip format, 16 gzip format */
+  ret = inflateInit2(&filter->strm, 32);
+  if (ret == Z_OK) {
+    filter->initialized = TRUE;
+    /* keep the original file name to help typefinding */
+    memset (&filter->gzip_header, 0, sizeof (filter->gzip_header));
+    memset (filter->gzip_name, 0, sizeof (filter->gzip_name));
+    filter->gzip_header.name = filter->gzip_name;
+    filter->gzip_header.name_max = sizeof (filter->gzip_name) - 1;
+    inflateGetHeader (&filter->strm, &filter->gzip_header);
+  } else {
+    GST_WARNING("Error when initializing the zlib\n");
+  }
+}
+
+/* push everything held back at the end of the stream */
+static void
+gst_gzdec_drain (Gstgzdec * filter)
+{
+  /* the last record does not need to be delimited */
+  gst_gzdec_flush_records (filter);
+  /* short streams are typefound from what there is */
+  gst_gzdec_push_held (filter, TRUE);
+  /* nothing was decoded, there are no caps to wait for */
+  if (filter->pending_segment) {
+    gst_pad_push_event (filter->srcpad, filter->pending_segment);
+    filter->pending_segment = NULL;
+  }
+  gst_clear_event (&filter->pending_tags);
+}
+
 /* this function handles sink events */
 static gboolean
 gst_gzdec_sink_event (GstPad * pad, GstObject * parent,
@@ -224,30 +672,23 @@ gst_gzdec_sink_event (GstPad * pad, GstObject * parent,
         g_print("Initializing decoder\n");
       }
       GST_DEBUG("GST_EVENT_STREAM_START\n");
-      filter->strm.zalloc = Z_NULL;
-      filter->strm.zfree = Z_NULL;
-      filter->strm.opaque = Z_NULL;
-      filter->strm.avail_in = 0;
-      filter->strm.next_in = Z_NULL;
-      /* 15 zlib fomat, 32 zlib and gzip format, 16 gzip format */
-      ret = inflateInit2(&filter->strm, 32);
-      if (ret == Z_OK) {
-        filter->initialized = TRUE;
-      } else {
-        GST_WARNING("Error when initializing the zlib\n");
-      }
+      gst_gzdec_reset (filter);
       ret = gst_pad_event_default (pad, parent, event);
       break;
     }
     case GST_EVENT_EOS:
     {
       GST_DEBUG("GST_EVENT_EOS\n");
+      /* streams shorter than a magic number are detected now */
+      if (filter->format == GZDEC_FORMAT_UNKNOWN)
+        gst_gzdec_detect (filter, TRUE);
+      gst_gzdec_drain (filter);
       if (!filter->silent) {
         g_print("Closing decoder. Total input bytes: %lu. Total output bytes: %lu\n",
                 filter->input_bytes, filter->output_bytes);
       }
       /* clean up and return */
-      (void)inflateEnd(&filter->strm);
+      gst_gzdec_inflate_end (filter);
       ret = gst_pad_event_default (pad, parent, event);
       break;
     }
@@ -256,11 +697,23 @@ gst_gzdec_sink_event (GstPad * pad, GstObject * parent,
       GstCaps *caps;
 
       gst_event_parse_caps (event, &caps);
-      /* do something with the caps */
       GST_DEBUG ("GST_EVENT_CAPS. caps are %" GST_PTR_FORMAT, caps);
 
-      /* and forward */
-      ret = gst_pad_event_default (pad, parent, event);
+      /* the src caps are typefound from the decoded data */
+      gst_event_unref (event);
+      ret = TRUE;
+      break;
+    }
+    case GST_EVENT_SEGMENT:
+    {
+      /* sticky events must follow the caps, which are not known yet */
+      if (!filter->caps_sent) {
+        gst_event_replace (&filter->pending_segment, event);
+        gst_event_unref (event);
+        ret = TRUE;
+      } else {
+        ret = gst_pad_event_default (pad, parent, event);
+      }
       break;
     }
     default:
@@ -271,134 +724,2011 @@ gst_gzdec_sink_event (GstPad * pad, GstObject * parent,
 }
 
 
-GstBuffer *gst_gzdec_decompress(GstBuffer *inputBuffer, Gstgzdec *filter)
+static inline const guint8 *
+gst_gzdec_memrchr (const guint8 * data, guint8 c, gsize size)
+{
+#ifdef HAVE_MEMRCHR
+  return memrchr (data, c, size);
+#else
+  while (size > 0) {
+    if (data[--size] == c)
+      return data + size;
+  }
+  return NULL;
+#endif
+}
+
+/* offset right after the last @delimiter in @buf, or 0 if there is none.
+ * Memories are scanned one by one from the end so they are never merged */
+static gsize
+gst_gzdec_find_record_end (GstBuffer * buf, guint8 delimiter)
 {
-  /* Default chunk_size */
-  const unsigned long long int chunk_size = 16384;
+  guint i = gst_buffer_n_memory (buf);
+  gsize end = gst_buffer_get_size (buf);
+
+  while (i > 0) {
+    GstMemory *memory = gst_buffer_peek_memory (buf, --i);
+    const guint8 *pos;
+    GstMapInfo map;
+    gsize found = 0;
+
+    if (!gst_memory_map (memory, &map, GST_MAP_READ))
+      return 0;
+    end -= map.size;
+    pos = gst_gzdec_memrchr (map.data, delimiter, map.size);
+    if (pos)
+      found = end + (pos - map.data) + 1;
+    gst_memory_unmap (memory, &map);
 
-  GstBuffer *outputBuffer = gst_buffer_new();
-  if (!outputBuffer) {
-    return NULL;
+    if (found)
+      return found;
   }
-  GstMemory *memory = NULL;
 
-  /* Intermediate buffer */
-  guint8 *input_data;
-  gsize input_data_size;
-  guint8 *output_data;
+  return 0;
+}
 
-  /* Mapping structures */
-  GstMapInfo map_in;
-  GstMapInfo map_out;
+/* offset right after the first @delimiter in @buf, or 0 if there is none */
+static gsize
+gst_gzdec_find_record_start (GstBuffer * buf, guint8 delimiter)
+{
+  guint i, n = gst_buffer_n_memory (buf);
+  gsize start = 0;
 
-  if (gst_buffer_map (inputBuffer, &map_in, GST_MAP_READ)) {
-    memory = gst_allocator_alloc(NULL, chunk_size, NULL);
+  for (i = 0; i < n; i++) {
+    GstMemory *memory = gst_buffer_peek_memory (buf, i);
+    const guint8 *pos;
+    GstMapInfo map;
+    gsize found = 0;
 
-    if (!gst_memory_map (memory, &map_out, GST_MAP_WRITE)) {
-      GST_ELEMENT_ERROR (GST_ELEMENT (NULL), STREAM, FAILED, (NULL), (NULL));
-      return NULL;
-    }
-  } else {
-    GST_ELEMENT_ERROR (GST_ELEMENT (NULL), STREAM, FAILED, (NULL), (NULL));
-    return NULL;
+    if (!gst_memory_map (memory, &map, GST_MAP_READ))
+      return 0;
+    pos = memchr (map.data, delimiter, map.size);
+    if (pos)
+      found = start + (pos - map.data) + 1;
+    start += map.size;
+    gst_memory_unmap (memory, &map);
+
+    if (found)
+      return found;
   }
 
-  /* Initialize mapping */
-  input_data = map_in.data;
-  input_data_size = map_in.size;
-  output_data = map_out.data;
+  return 0;
+}
 
-  /* Error handler for zlib */
-  int ret;
-  /* Available data in the ouput buffer */
-  unsigned have;
+/* copy the record tail into a single memory, so that more decoded data can
+ * be appended to it without merging its memories */
+static void
+gst_gzdec_compact_records (Gstgzdec * filter)
+{
+  GstBuffer *tail = filter->record_tail;
+  gsize size = gst_buffer_get_size (tail);
+  GstMemory *memory;
+  GstMapInfo map;
 
-  GST_DEBUG("RAW input data size: %lu\n", input_data_size);
-  filter->strm.avail_in = input_data_size;
-  if (filter->strm.avail_in == 0) {
-      return NULL;
+  GZDEC_PROBE2 (alloc, filter, size);
+  memory = gst_allocator_alloc (NULL, size, NULL);
+  if (!gst_memory_map (memory, &map, GST_MAP_WRITE)) {
+    gst_memory_unref (memory);
+    return;
   }
-  filter->strm.next_in = input_data;
+  gst_buffer_extract (tail, 0, map.data, size);
+  gst_memory_unmap (memory, &map);
 
-  /* run inflate() on input until output buffer not full */
-  do {
-      filter->strm.avail_out = chunk_size;
-      filter->strm.next_out = output_data;
-      ret = inflate(&filter->strm, Z_NO_FLUSH);
-      switch (ret) {
-      case Z_NEED_DICT:
-          ret = Z_DATA_ERROR;     /* and fall through */
-      case Z_DATA_ERROR:
-      case Z_MEM_ERROR:
-          (void)inflateEnd(&filter->strm);
-          return NULL;
-      }
-      have = chunk_size - filter->strm.avail_out;
-      GST_DEBUG("Decompressed size %d\n", have);
+  filter->record_tail = gst_buffer_new ();
+  gst_buffer_append_memory (filter->record_tail, memory);
+  gst_buffer_unref (tail);
+}
+
+/* cut @outbuf after its last record and push the complete records, flagged
+ * with GST_BUFFER_FLAG_MARKER. The sub-buffers share the decoded memories,
+ * so nothing is copied.
+ *
+ * The record tail may not have room for @outbuf without merging their
+ * memories. When it is at most a chunk, it is copied into a single memory
+ * to keep its record whole. Otherwise the record is too long to be held,
+ * and it is pushed in several unflagged buffers up to its delimiter, so
+ * that flagged buffers always hold whole records */
+static GstFlowReturn
+gst_gzdec_push_records (Gstgzdec * filter, GstBuffer * outbuf)
+{
+  gsize size = gst_buffer_get_size (outbuf);
+  gsize end = gst_gzdec_find_record_end (outbuf, filter->record_delimiter);
+  gsize start = 0;
+  GstBuffer *records;
+  GstFlowReturn flow;
 
+  if (filter->record_tail && gst_buffer_n_memory (filter->record_tail) +
+      gst_buffer_n_memory (outbuf) > gst_buffer_get_max_memory ()) {
+    if (gst_buffer_get_size (filter->record_tail) <= GZDEC_CHUNK_SIZE)
+      gst_gzdec_compact_records (filter);
 
-      /* Last chunk */
-      if (have <= chunk_size) {
-        /* Allocate more data for the last output buffer */
-        GstMemory *lastChunkMemory = gst_allocator_alloc(NULL, have, NULL);
-        lastChunkMemory = gst_memory_copy(memory, 0, have);
-        gst_buffer_insert_memory(outputBuffer, -1, lastChunkMemory);
-      } else {
-        /* Release memory by itselft since that memory it is
-         * not inserted into the buffer */
-        gst_memory_unmap(memory, &map_out);
-        /* Append to the buffer current memory data */
-        gst_buffer_insert_memory(outputBuffer, -1, memory);
-        gst_memory_unref(memory);
-        /* Allocate more data for the next output buffer */
-        memory = gst_allocator_alloc(NULL, chunk_size, NULL);
-        if (!gst_memory_map(memory, &map_out, GST_MAP_WRITE)) {
-          return NULL;
-        }
-        output_data = map_out.data;
+    if (gst_buffer_n_memory (filter->record_tail) +
+        gst_buffer_n_memory (outbuf) > gst_buffer_get_max_memory ()) {
+      flow = gst_gzdec_flush_records (filter);
+      filter->record_split = TRUE;
+
+      if (flow != GST_FLOW_OK) {
+        gst_buffer_unref (outbuf);
+        return flow;
       }
-  } while (filter->strm.avail_out == 0);
+    }
+  }
+
+  if (end == 0) {
+    /* no delimiter at all, wait for the rest of the record */
+    if (filter->record_tail)
+      outbuf = gst_buffer_append (filter->record_tail, outbuf);
+    filter->record_tail = outbuf;
+    return GST_FLOW_OK;
+  }
+
+  if (filter->record_split) {
+    /* the end of a record whose start was already pushed */
+    start = gst_gzdec_find_record_start (outbuf, filter->record_delimiter);
+    records = gst_buffer_copy_region (outbuf, GST_BUFFER_COPY_MEMORY, 0,
+        start);
+    if (filter->record_tail)
+      records = gst_buffer_append (filter->record_tail, records);
+    filter->record_tail = NULL;
+    filter->record_split = FALSE;
+
+    flow = gst_gzdec_push (filter, records);
+    if (flow != GST_FLOW_OK) {
+      gst_buffer_unref (outbuf);
+      return flow;
+    }
+  }
+
+  records = NULL;
+  if (start < end) {
+    records = gst_buffer_copy_region (outbuf, GST_BUFFER_COPY_MEMORY, start,
+        end - start);
+    if (filter->record_tail)
+      records = gst_buffer_append (filter->record_tail, records);
+  }
+  filter->record_tail = NULL;
+  if (end < size)
+    filter->record_tail = gst_buffer_copy_region (outbuf,
+        GST_BUFFER_COPY_MEMORY, end, size - end);
+  gst_buffer_unref (outbuf);
+
+  if (!records)
+    return GST_FLOW_OK;
+
+  GST_BUFFER_FLAG_SET (records, GST_BUFFER_FLAG_MARKER);
+  return gst_gzdec_push (filter, records);
+}
+
+/* push a decoded buffer downstream, after the caps */
+static GstFlowReturn
+gst_gzdec_push_buffer (Gstgzdec * filter, GstBuffer * outbuf)
+{
+  GstFlowReturn flow;
+  gsize size = gst_buffer_get_size (outbuf);
 
-  /* Clean up the input */
-  gst_buffer_unmap (inputBuffer, &map_in);
+  filter->output_bytes += size;
 
-  return outputBuffer;
+  GZDEC_PROBE2 (push__enter, filter, size);
+  flow = gst_pad_push (filter->srcpad, outbuf);
+  GZDEC_PROBE2 (push__return, filter, flow);
+
+  return flow;
 }
 
+static void
+gst_gzdec_clear_held (Gstgzdec * filter)
+{
+  GstBuffer *buf;
 
-/* chain function
- * this function does the actual processing
- */
+  while ((buf = g_queue_pop_head (&filter->typefind_held)))
+    gst_buffer_unref (buf);
+  filter->typefind_size = 0;
+  filter->typefind_tried = 0;
+}
+
+/* typefind the decoded data held so far, helped by the original file name
+ * from the gzip header, and set precise src caps so downstream does not
+ * need to typefind again. The decision waits for GZDEC_TYPEFIND_SIZE bytes
+ * unless a typefinder is already certain, or @force is set because no more
+ * data is coming. The segment and tags received meanwhile follow the caps,
+ * then the held data is pushed */
 static GstFlowReturn
-gst_gzdec_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+gst_gzdec_push_held (Gstgzdec * filter, gboolean force)
 {
-  Gstgzdec *filter;
-  GstBuffer *outbuf = NULL;
+  GstTypeFindProbability prob = GST_TYPE_FIND_NONE;
+  GstFlowReturn flow = GST_FLOW_OK;
+  guint8 peek[GZDEC_TYPEFIND_SIZE];
+  const gchar *extension = NULL;
+  gsize size = 0;
+  GstCaps *caps, *current;
+  GstBuffer *buf;
+  GList *l;
 
-  filter = GST_GZDEC (parent);
-  if (filter->initialized == FALSE) {
-    GST_ERROR("Processing is not possible. Decoder it is not initialized");
-    return GST_FLOW_ERROR;
+  if (g_queue_is_empty (&filter->typefind_held))
+    return GST_FLOW_OK;
+
+  /* typefinding again for every small buffer would cost more than the
+   * decoding itself, so only do it when the held data doubled */
+  if (!force && filter->typefind_size < GZDEC_TYPEFIND_SIZE) {
+    if (filter->typefind_size < 2 * filter->typefind_tried)
+      return GST_FLOW_OK;
+    filter->typefind_tried = filter->typefind_size;
+  }
+
+  if (filter->entry_name) {
+    extension = strrchr (filter->entry_name, '.');
+    if (extension)
+      extension++;
+  } else if (filter->format == GZDEC_FORMAT_ZLIB && !filter->tar &&
+      filter->gzip_header.done == 1) {
+    extension = strrchr ((const gchar *) filter->gzip_name, '.');
+    if (extension)
+      extension++;
+  }
+
+  /* only peek at the start, buffers can be huge and mapping them whole
+   * would merge their memories */
+  for (l = filter->typefind_held.head; l && size < sizeof (peek); l = l->next)
+    size += gst_buffer_extract (l->data, 0, peek + size, sizeof (peek) - size);
+  caps = gst_type_find_helper_for_data_with_extension (GST_OBJECT (filter),
+      peek, size, extension, &prob);
+
+  if (!force && size < GZDEC_TYPEFIND_SIZE &&
+      prob < GST_TYPE_FIND_MAXIMUM) {
+    gst_clear_caps (&caps);
+    return GST_FLOW_OK;
+  }
+
+  if (!caps && extension)
+    caps = gst_type_find_helper_for_extension (GST_OBJECT (filter), extension);
+  if (!caps)
+    caps = gst_caps_new_empty_simple ("application/octet-stream");
+
+  GST_DEBUG_OBJECT (filter, "Output caps %" GST_PTR_FORMAT
+      " (probability %d)", caps, prob);
+  current = gst_pad_get_current_caps (filter->srcpad);
+  if (!current || !gst_caps_is_equal (caps, current))
+    gst_pad_push_event (filter->srcpad, gst_event_new_caps (caps));
+  gst_clear_caps (&current);
+  gst_caps_unref (caps);
+  filter->caps_sent = TRUE;
+
+  if (filter->pending_segment) {
+    gst_pad_push_event (filter->srcpad, filter->pending_segment);
+    filter->pending_segment = NULL;
+  }
+  if (filter->pending_tags) {
+    gst_pad_push_event (filter->srcpad, filter->pending_tags);
+    filter->pending_tags = NULL;
+  }
+
+  filter->typefind_size = 0;
+  filter->typefind_tried = 0;
+  while ((buf = g_queue_pop_head (&filter->typefind_held))) {
+    if (flow == GST_FLOW_OK)
+      flow = gst_gzdec_push_buffer (filter, buf);
+    else
+      gst_buffer_unref (buf);
+  }
+
+  return flow;
+}
+
+/* push decoded data downstream, once its type is known */
+static GstFlowReturn
+gst_gzdec_push (Gstgzdec * filter, GstBuffer * outbuf)
+{
+  if (filter->caps_sent)
+    return gst_gzdec_push_buffer (filter, outbuf);
+
+  g_queue_push_tail (&filter->typefind_held, outbuf);
+  filter->typefind_size += gst_buffer_get_size (outbuf);
+
+  return gst_gzdec_push_held (filter, FALSE);
+}
+
+/* end the current record run, the remainder is pushed as is */
+static GstFlowReturn
+gst_gzdec_flush_records (Gstgzdec * filter)
+{
+  GstBuffer *tail = filter->record_tail;
+
+  filter->record_split = FALSE;
+  if (!tail)
+    return GST_FLOW_OK;
+
+  filter->record_tail = NULL;
+  return gst_gzdec_push (filter, tail);
+}
+
+/* memories of the decoded data held back, that the next output buffer
+ * will be appended to */
+static guint
+gst_gzdec_held_memories (Gstgzdec * filter)
+{
+  return filter->record_tail ? gst_buffer_n_memory (filter->record_tail) : 0;
+}
+
+static GstFlowReturn
+gst_gzdec_push_data (Gstgzdec * filter, GstBuffer * outbuf)
+{
+  if (filter->record_delimiter >= 0)
+    return gst_gzdec_push_records (filter, outbuf);
+
+  return gst_gzdec_push (filter, outbuf);
+}
+
+/* entry names are raw bytes in the charset of the archiver, which is CP437
+ * for zip entries without the UTF-8 flag and unknown for tar. Names that
+ * are already valid UTF-8 are kept as is since most archivers write them
+ * without saying so */
+static gchar *
+gst_gzdec_entry_name_to_utf8 (const gchar * name, const gchar * charset)
+{
+  gchar *utf8;
+
+  if (g_utf8_validate (name, -1, NULL))
+    return g_strdup (name);
+
+  utf8 = g_convert (name, -1, "UTF-8", charset, NULL, NULL, NULL);
+  if (!utf8)
+    utf8 = g_utf8_make_valid (name, -1);
+
+  return utf8;
+}
+
+/* archive entries matching the entry-filter are announced downstream with
+ * a tag event carrying their UTF-8 name, followed by their content */
+static gboolean
+gst_gzdec_match_entry (Gstgzdec * filter, const gchar * name)
+{
+  if (filter->entry && strcmp (name, filter->entry) != 0)
+    return FALSE;
+
+  if (filter->entry_pattern) {
+#if GLIB_CHECK_VERSION(2,70,0)
+    if (!g_pattern_spec_match_string (filter->entry_pattern, name))
+#else
+    if (!g_pattern_match_string (filter->entry_pattern, name))
+#endif
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* every entry has its own type, its tag waits for the caps found from its
+ * first data */
+static void
+gst_gzdec_announce_entry (Gstgzdec * filter, const gchar * name)
+{
+  GstTagList *tags;
+
+  GST_DEBUG_OBJECT (filter, "Extracting entry %s", name);
+  g_free (filter->entry_name);
+  filter->entry_name = g_strdup (name);
+  filter->caps_sent = FALSE;
+  tags = gst_tag_list_new (GST_TAG_TITLE, name, NULL);
+  gst_event_take (&filter->pending_tags, gst_event_new_tag (tags));
+}
+
+/* an entry always ends its last record, and its type is decided with what
+ * there is */
+static GstFlowReturn
+gst_gzdec_end_entry (Gstgzdec * filter)
+{
+  GstFlowReturn flow;
+
+  flow = gst_gzdec_flush_records (filter);
+  if (flow != GST_FLOW_OK)
+    return flow;
+
+  return gst_gzdec_push_held (filter, TRUE);
+}
+
+static gboolean
+gst_gzdec_select_entry (Gstgzdec * filter, const gchar * name)
+{
+  if (!gst_gzdec_match_entry (filter, name)) {
+    GST_DEBUG_OBJECT (filter, "Skipping entry %s", name);
+    return FALSE;
   }
 
-  if (!filter->silent) {
-    filter->input_bytes += gst_buffer_get_size(buf);
+  gst_gzdec_announce_entry (filter, name);
+  return TRUE;
+}
+
+/* tar numbers are octal strings, or base-256 for GNU big numbers */
+static guint64
+gst_gzdec_tar_number (const guint8 * field, gsize len)
+{
+  guint64 value = 0;
+  gsize i;
+
+  if (field[0] & 0x80) {
+    value = field[0] & 0x7f;
+    for (i = 1; i < len; i++)
+      value = (value << 8) | field[i];
+    return value;
   }
 
-  outbuf = gst_gzdec_decompress(buf, filter);
+  for (i = 0; i < len && field[i] == ' '; i++);
+  for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+    value = (value << 3) | (field[i] - '0');
+
+  return value;
+}
+
+static GstFlowReturn
+gst_gzdec_tar_header (Gstgzdec * filter)
+{
+  guint8 block[TAR_BLOCK_SIZE];
+  guint64 checksum = 0;
+  gchar *name, *utf8;
+  gchar type;
+  gsize i;
+
+  gst_adapter_copy (filter->tar_adapter, block, 0, TAR_BLOCK_SIZE);
+  gst_adapter_flush (filter->tar_adapter, TAR_BLOCK_SIZE);
 
-  gst_buffer_unref(buf);
-  if (!outbuf) {
-    GST_ERROR("Error when inflating the data in the pipeline");
-    /* something went wrong - signal an error */
-    GST_ELEMENT_ERROR (GST_ELEMENT (filter), STREAM, FAILED, (NULL), (NULL));
+  /* end of archive marker, whatever follows is padding */
+  if (block[0] == '\0') {
+    GST_DEBUG_OBJECT (filter, "End of tar archive");
+    filter->tar_state = GZDEC_TAR_END;
+    return GST_FLOW_OK;
+  }
+
+  /* the checksum is computed with its own field filled with spaces */
+  for (i = 0; i < TAR_BLOCK_SIZE; i++)
+    checksum += (i >= 148 && i < 156) ? ' ' : block[i];
+  if (checksum != gst_gzdec_tar_number (block + 148, 8)) {
+    GST_ELEMENT_ERROR (filter, STREAM, DEMUX, (NULL),
+        ("Invalid tar header checksum"));
     return GST_FLOW_ERROR;
   }
-  if (!filter->silent) {
-      filter->output_bytes += gst_buffer_get_size(outbuf);
+
+  type = block[156];
+  filter->tar_remaining = gst_gzdec_tar_number (block + 124, 12);
+  filter->tar_padding = (TAR_BLOCK_SIZE -
+      filter->tar_remaining % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+  /* GNU long name and pax extended headers describe the next entry */
+  if (type == 'L' || type == 'x') {
+    if (filter->tar_remaining > TAR_MAX_LONG_HEADER) {
+      GST_ELEMENT_ERROR (filter, STREAM, DEMUX, (NULL),
+          ("Tar extended header too big"));
+      return GST_FLOW_ERROR;
+    }
+    filter->tar_long_header = type;
+    filter->tar_state = GZDEC_TAR_LONG_HEADER;
+    return GST_FLOW_OK;
+  }
+
+  if (filter->tar_long_name) {
+    name = filter->tar_long_name;
+    filter->tar_long_name = NULL;
+  } else if (memcmp (block + 257, "ustar", 5) == 0 && block[345] != '\0') {
+    name = g_strdup_printf ("%.155s/%.100s", (gchar *) block + 345,
+        (gchar *) block);
+  } else {
+    name = g_strndup ((gchar *) block, 100);
+  }
+  /* pax names are UTF-8, others are most likely Latin-1 when they are not */
+  utf8 = gst_gzdec_entry_name_to_utf8 (name, "ISO-8859-1");
+  g_free (name);
+  name = utf8;
+
+  /* only regular files have content worth pushing */
+  filter->tar_selected = (type == '0' || type == '\0' || type == '7') &&
+      gst_gzdec_select_entry (filter, name);
+  filter->tar_state = GZDEC_TAR_DATA;
+  g_free (name);
+
+  return GST_FLOW_OK;
+}
+
+/* keep the name from a GNU long name entry or a pax "path" record */
+static void
+gst_gzdec_tar_long_header (Gstgzdec * filter)
+{
+  gsize size = filter->tar_remaining;
+  gchar *data = g_malloc (size + 1);
+  gchar *record = data;
+
+  gst_adapter_copy (filter->tar_adapter, data, 0, size);
+  gst_adapter_flush (filter->tar_adapter, size);
+  data[size] = '\0';
+
+  if (filter->tar_long_header == 'L') {
+    g_free (filter->tar_long_name);
+    filter->tar_long_name = g_strdup (data);
+    g_free (data);
+    return;
+  }
+
+  /* pax records are "<length> <key>=<value>\n" */
+  while (record < data + size) {
+    gchar *key, *end;
+    guint64 len = g_ascii_strtoull (record, &key, 10);
+
+    if (len == 0 || record + len > data + size || *key != ' ')
+      break;
+    end = record + len - 1;
+    if (g_str_has_prefix (key + 1, "path=") && *end == '\n') {
+      g_free (filter->tar_long_name);
+      filter->tar_long_name = g_strndup (key + 6, end - (key + 6));
+    }
+    record += len;
+  }
+  g_free (data);
+}
+
+/* parse the decoded data as a tar archive and push the selected entries.
+ * Their content is taken from the adapter without copying and skipped
+ * entries are just flushed */
+static GstFlowReturn
+gst_gzdec_tar_parse (Gstgzdec * filter, GstBuffer * outbuf)
+{
+  GstFlowReturn flow = GST_FLOW_OK;
+  gsize avail, size;
+
+  gst_adapter_push (filter->tar_adapter, outbuf);
+
+  while (flow == GST_FLOW_OK) {
+    avail = gst_adapter_available (filter->tar_adapter);
+
+    switch (filter->tar_state) {
+      case GZDEC_TAR_HEADER:
+        if (avail < TAR_BLOCK_SIZE)
+          return flow;
+        flow = gst_gzdec_tar_header (filter);
+        break;
+      case GZDEC_TAR_LONG_HEADER:
+        if (avail < filter->tar_remaining)
+          return flow;
+        gst_gzdec_tar_long_header (filter);
+        filter->tar_state = GZDEC_TAR_PADDING;
+        break;
+      case GZDEC_TAR_DATA:
+        size = MIN (avail, filter->tar_remaining);
+        if (size == 0 && filter->tar_remaining > 0)
+          return flow;
+        if (size > 0 && filter->tar_selected) {
+          flow = gst_gzdec_push_data (filter,
+              gst_adapter_take_buffer_fast (filter->tar_adapter, size));
+        } else if (size > 0) {
+          gst_adapter_flush (filter->tar_adapter, size);
+        }
+        filter->tar_remaining -= size;
+        if (filter->tar_remaining == 0) {
+          if (flow == GST_FLOW_OK && filter->tar_selected)
+            flow = gst_gzdec_end_entry (filter);
+          filter->tar_state = GZDEC_TAR_PADDING;
+        }
+        break;
+      case GZDEC_TAR_PADDING:
+        size = MIN (avail, filter->tar_padding);
+        if (size == 0 && filter->tar_padding > 0)
+          return flow;
+        gst_adapter_flush (filter->tar_adapter, size);
+        filter->tar_padding -= size;
+        if (filter->tar_padding == 0)
+          filter->tar_state = GZDEC_TAR_HEADER;
+        break;
+      case GZDEC_TAR_END:
+        gst_adapter_clear (filter->tar_adapter);
+        return flow;
+    }
+  }
+
+  return flow;
+}
+
+static GstFlowReturn
+gst_gzdec_push_output (Gstgzdec * filter, GstBuffer * outbuf)
+{
+  /* in pull mode the decoded data waits for getrange requests */
+  if (GST_PAD_MODE (filter->srcpad) == GST_PAD_MODE_PULL) {
+    gsize size = gst_buffer_get_size (outbuf);
+
+    filter->output_bytes += size;
+    filter->pull_out_offset += size;
+    gst_adapter_push (filter->pull_cache, outbuf);
+    return GST_FLOW_OK;
+  }
+
+  /* zip entries that were not selected are inflated only to find their end */
+  if (filter->format == GZDEC_FORMAT_ZIP) {
+    if (!filter->zip_selected) {
+      gst_buffer_unref (outbuf);
+      return GST_FLOW_OK;
+    }
+    return gst_gzdec_push_data (filter, outbuf);
+  }
+
+  if (filter->tar)
+    return gst_gzdec_tar_parse (filter, outbuf);
+
+  return gst_gzdec_push_data (filter, outbuf);
+}
+
+/* where the next inflate() call writes: the free part of the current
+ * block */
+typedef struct
+{
+  guint8 *data;
+  gsize size;
+} GzdecOutput;
+
+static void
+gst_gzdec_block_release (Gstgzdec * filter)
+{
+  if (!filter->block)
+    return;
+
+  gst_memory_unref (filter->block);
+  filter->block = NULL;
+  filter->block_data = NULL;
+}
+
+#ifdef GZDEC_HAVE_MEMFD
+static void
+gst_gzdec_memfd_block_freed (gpointer data, GstMiniObject * block)
+{
+  g_atomic_int_add (&memfd_blocks, -1);
+}
+
+/* start a new memfd block, FALSE if none could be made and system memory
+ * has to be used instead.
+ *
+ * Blocks are never left mapped: gst_memory_share() refuses to slice a
+ * memory mapped for writing, and once two slices are alive they lock it
+ * against any new write mapping. It is mapped once to set up the mapping,
+ * which KEEP_MAPPED keeps until the block is freed, and inflate() then
+ * writes through that pointer past the end of the last slice. The slices
+ * keep the block alive until downstream is done with them */
+static gboolean
+gst_gzdec_memfd_block_new (Gstgzdec * filter)
+{
+  GstMemory *block;
+  GstMapInfo map;
+  int fd;
+
+  fd = memfd_create ("gzdec", MFD_CLOEXEC);
+  if (fd < 0 || ftruncate (fd, GZDEC_MEMFD_BLOCK_SIZE) < 0) {
+    GST_WARNING_OBJECT (filter, "Unable to allocate a memfd, using system "
+        "memory: %s", g_strerror (errno));
+    if (fd >= 0)
+      close (fd);
+    return FALSE;
+  }
+
+  GZDEC_PROBE2 (alloc, filter, GZDEC_MEMFD_BLOCK_SIZE);
+  block = gst_fd_allocator_alloc (filter->fd_allocator, fd,
+      GZDEC_MEMFD_BLOCK_SIZE, GST_FD_MEMORY_FLAG_KEEP_MAPPED);
+  if (!block || !gst_memory_map (block, &map, GST_MAP_WRITE)) {
+    if (block)
+      gst_memory_unref (block);
+    GST_WARNING_OBJECT (filter, "Unable to map the memfd, using system "
+        "memory");
+    return FALSE;
+  }
+  filter->block_data = map.data;
+  gst_memory_unmap (block, &map);
+
+  g_atomic_int_inc (&memfd_blocks);
+  gst_mini_object_weak_ref (GST_MINI_OBJECT_CAST (block),
+      gst_gzdec_memfd_block_freed, NULL);
+  filter->block = block;
+  filter->block_offset = 0;
+
+  return TRUE;
+}
+#endif
+
+/* start a new chunk of system memory, sliced like memfd blocks. Its data
+ * does not move once mapped */
+static gboolean
+gst_gzdec_chunk_new (Gstgzdec * filter)
+{
+  GstMemory *block;
+  GstMapInfo map;
+
+  GZDEC_PROBE2 (alloc, filter, GZDEC_CHUNK_SIZE);
+  block = gst_allocator_alloc (NULL, GZDEC_CHUNK_SIZE, NULL);
+  if (!gst_memory_map (block, &map, GST_MAP_WRITE)) {
+    gst_memory_unref (block);
+    GST_ELEMENT_ERROR (filter, STREAM, FAILED, (NULL),
+        ("Unable to map the output memory"));
+    return FALSE;
+  }
+  filter->block_data = map.data;
+  gst_memory_unmap (block, &map);
+
+  filter->block = block;
+  filter->block_offset = 0;
+
+  return TRUE;
+}
+
+static gboolean
+gst_gzdec_output_begin (Gstgzdec * filter, GzdecOutput * out)
+{
+  if (filter->block && filter->block_offset == filter->block->size)
+    gst_gzdec_block_release (filter);
+
+  if (!filter->block) {
+    gboolean have_block = FALSE;
+
+#ifdef GZDEC_HAVE_MEMFD
+    /* when too many blocks are still held downstream, fall back to system
+     * memory rather than running out of file descriptors */
+    if (filter->memfd &&
+        g_atomic_int_get (&memfd_blocks) < GZDEC_MEMFD_MAX_BLOCKS)
+      have_block = gst_gzdec_memfd_block_new (filter);
+#endif
+    if (!have_block && !gst_gzdec_chunk_new (filter))
+      return FALSE;
+  }
+
+  out->data = filter->block_data + filter->block_offset;
+  out->size = MIN (filter->block->size - filter->block_offset,
+      GZDEC_CHUNK_SIZE);
+
+  return TRUE;
+}
+
+/* set @memory to a slice of the block holding the @have bytes inflate()
+ * wrote, or to NULL if none. The next output starts right after it */
+static gboolean
+gst_gzdec_output_end (Gstgzdec * filter, GzdecOutput * out, gsize have,
+    GstMemory ** memory)
+{
+  *memory = NULL;
+  if (have == 0)
+    return TRUE;
+
+  *memory = gst_memory_share (filter->block, filter->block_offset, have);
+  if (!*memory) {
+    GST_ELEMENT_ERROR (filter, STREAM, FAILED, (NULL),
+        ("Unable to share the output memory"));
+    return FALSE;
+  }
+  filter->block_offset += have;
+
+  return TRUE;
+}
+
+/* inflate @data and push the decoded data, until the input is exhausted
+ * or the end of the deflate stream. strm.avail_in tells how much input is
+ * left and stream_end whether the stream is over.
+ *
+ * The output is inflated in place into the free part of the current block
+ * and handed over to the output buffer as slices of the decoded size, so
+ * the decoded data is never copied and the next call goes on filling the
+ * same block. The output buffer is pushed once it holds,
+ * along with the record tail it is appended to, as many memories as a
+ * buffer can take without merging them.
+ */
+static GstFlowReturn
+gst_gzdec_inflate (Gstgzdec * filter, const guint8 * data, gsize size)
+{
+  GstFlowReturn flow = GST_FLOW_OK;
+  GstBuffer *outbuf;
+  GstMemory *memory;
+  GzdecOutput out;
+  gsize have;
+  int ret = Z_OK;
+  /* input sniffed as zlib can still turn out not to be compressed until
+   * some decoded data is pushed */
+  gboolean sniffed = filter->passthrough_uncompressed &&
+      filter->format == GZDEC_FORMAT_ZLIB && filter->strm.total_out == 0;
+
+  GST_DEBUG_OBJECT (filter, "RAW input data size: %" G_GSIZE_FORMAT, size);
+  filter->strm.avail_in = size;
+  filter->strm.next_in = (Bytef *) data;
+
+  outbuf = gst_buffer_new ();
+
+  /* run inflate() on input until output buffer not full */
+  do {
+    if (!gst_gzdec_output_begin (filter, &out)) {
+      flow = GST_FLOW_ERROR;
+      break;
+    }
+
+    filter->strm.avail_out = out.size;
+    filter->strm.next_out = out.data;
+    GZDEC_PROBE2 (inflate__enter, filter, filter->strm.avail_in);
+    ret = inflate (&filter->strm, Z_NO_FLUSH);
+    if (ret == Z_NEED_DICT && gst_gzdec_set_dictionary (filter))
+      ret = inflate (&filter->strm, Z_NO_FLUSH);
+    have = out.size - filter->strm.avail_out;
+    GZDEC_PROBE3 (inflate__return, filter, ret, have);
+
+    if (sniffed && (ret == Z_DATA_ERROR || ret == Z_NEED_DICT)) {
+      GST_DEBUG_OBJECT (filter, "Input does not inflate, passing it through");
+      filter->format = GZDEC_FORMAT_PLAIN;
+      break;
+    }
+
+    if (!gst_gzdec_output_end (filter, &out, have, &memory)) {
+      flow = GST_FLOW_ERROR;
+      break;
+    }
+
+    switch (ret) {
+      case Z_NEED_DICT:
+      case Z_DATA_ERROR:
+      case Z_MEM_ERROR:
+      case Z_STREAM_ERROR:
+        if (memory)
+          gst_memory_unref (memory);
+        GST_ELEMENT_ERROR (filter, STREAM, DECODE, (NULL),
+            ("Error when inflating the data: %s",
+                GST_STR_NULL (filter->strm.msg)));
+        flow = GST_FLOW_ERROR;
+        break;
+    }
+    if (flow != GST_FLOW_OK)
+      break;
+
+    GST_LOG_OBJECT (filter, "Decompressed size %" G_GSIZE_FORMAT, have);
+    if (!memory)
+      continue;
+    gst_buffer_append_memory (outbuf, memory);
+
+    if (gst_buffer_n_memory (outbuf) + gst_gzdec_held_memories (filter) >=
+        gst_buffer_get_max_memory ()) {
+      flow = gst_gzdec_push_output (filter, outbuf);
+      outbuf = gst_buffer_new ();
+      sniffed = FALSE;
+    }
+  } while (flow == GST_FLOW_OK && ret != Z_STREAM_END &&
+      filter->strm.avail_out == 0);
+
+  filter->stream_end = (ret == Z_STREAM_END);
+
+  /* what inflated from input that is not compressed after all is dropped */
+  if (flow == GST_FLOW_OK && gst_buffer_n_memory (outbuf) > 0 &&
+      filter->format != GZDEC_FORMAT_PLAIN)
+    return gst_gzdec_push_output (filter, outbuf);
+
+  gst_buffer_unref (outbuf);
+  return flow;
+}
+
+/* inflate the whole input buffer and push the decoded data */
+static GstFlowReturn
+gst_gzdec_decompress (Gstgzdec * filter, GstBuffer * inbuf)
+{
+  GstFlowReturn flow;
+  GstMapInfo map_in;
+
+  if (!gst_buffer_map (inbuf, &map_in, GST_MAP_READ)) {
+    GST_ELEMENT_ERROR (filter, STREAM, FAILED, (NULL),
+        ("Unable to map the input buffer"));
+    return GST_FLOW_ERROR;
+  }
+
+  flow = gst_gzdec_inflate (filter, map_in.data, map_in.size);
+  gst_buffer_unmap (inbuf, &map_in);
+
+  return flow;
+}
+
+
+/* ZIP archives are parsed as a stream of local file headers, so entries
+ * are extracted in a single pass and even from non seekable sources.
+ * Entries that are not selected are skipped without being inflated when
+ * the local header gives their size */
+static GstFlowReturn
+gst_gzdec_zip_header (Gstgzdec * filter)
+{
+  GstAdapter *adapter = filter->zip_adapter;
+  gsize avail = gst_adapter_available (adapter);
+  const guint8 *header, *extra;
+  guint flags, method, name_len, extra_len;
+  guint64 csize, usize;
+  gboolean supported;
+  guint32 signature;
+  gchar *raw_name, *name;
+
+  if (avail < 4)
+    return GST_FLOW_OK;
+
+  header = gst_adapter_map (adapter, 4);
+  signature = GST_READ_UINT32_LE (header);
+  gst_adapter_unmap (adapter);
+
+  if (signature == ZIP_CENTRAL_DIRECTORY_SIG
+      || signature == ZIP_END_OF_CENTRAL_DIRECTORY_SIG) {
+    GST_DEBUG_OBJECT (filter, "End of zip entries");
+    filter->zip_state = GZDEC_ZIP_END;
+    return GST_FLOW_OK;
+  }
+  if (signature != ZIP_LOCAL_HEADER_SIG) {
+    GST_ELEMENT_ERROR (filter, STREAM, DEMUX, (NULL),
+        ("Invalid zip local header signature 0x%08x", signature));
+    return GST_FLOW_ERROR;
+  }
+
+  if (avail < ZIP_LOCAL_HEADER_SIZE)
+    return GST_FLOW_OK;
+
+  header = gst_adapter_map (adapter, ZIP_LOCAL_HEADER_SIZE);
+  flags = GST_READ_UINT16_LE (header + 6);
+  method = GST_READ_UINT16_LE (header + 8);
+  csize = GST_READ_UINT32_LE (header + 18);
+  usize = GST_READ_UINT32_LE (header + 22);
+  name_len = GST_READ_UINT16_LE (header + 26);
+  extra_len = GST_READ_UINT16_LE (header + 28);
+  gst_adapter_unmap (adapter);
+
+  if (avail < ZIP_LOCAL_HEADER_SIZE + name_len + extra_len)
+    return GST_FLOW_OK;
+
+  header = gst_adapter_map (adapter,
+      ZIP_LOCAL_HEADER_SIZE + name_len + extra_len);
+  raw_name = g_strndup ((const gchar *) header + ZIP_LOCAL_HEADER_SIZE,
+      name_len);
+  name = gst_gzdec_entry_name_to_utf8 (raw_name,
+      (flags & ZIP_FLAG_UTF8) ? "UTF-8" : "CP437");
+  g_free (raw_name);
+
+  /* ZIP64 sizes live in the extra field */
+  filter->zip64 = FALSE;
+  extra = header + ZIP_LOCAL_HEADER_SIZE + name_len;
+  while (extra + 4 <= header + ZIP_LOCAL_HEADER_SIZE + name_len + extra_len) {
+    guint id = GST_READ_UINT16_LE (extra);
+    guint len = GST_READ_UINT16_LE (extra + 2);
+
+    if (id == 0x0001 && len >= 16 &&
+        extra + 4 + len <= header + ZIP_LOCAL_HEADER_SIZE + name_len +
+        extra_len) {
+      usize = GST_READ_UINT64_LE (extra + 4);
+      csize = GST_READ_UINT64_LE (extra + 12);
+      filter->zip64 = TRUE;
+    }
+    extra += 4 + len;
+  }
+  gst_adapter_unmap (adapter);
+  gst_adapter_flush (adapter, ZIP_LOCAL_HEADER_SIZE + name_len + extra_len);
+
+  GST_DEBUG_OBJECT (filter, "Zip entry %s, method %u, flags 0x%04x, %"
+      G_GUINT64_FORMAT " -> %" G_GUINT64_FORMAT " bytes", name, method,
+      flags, csize, usize);
+
+  filter->zip_method = method;
+  filter->zip_descriptor = (flags & ZIP_FLAG_DATA_DESCRIPTOR) != 0;
+  filter->zip_remaining = csize;
+
+  supported = (method == ZIP_METHOD_STORED || method == ZIP_METHOD_DEFLATE)
+      && !(flags & ZIP_FLAG_ENCRYPTED) && !g_str_has_suffix (name, "/");
+  filter->zip_selected = supported && gst_gzdec_select_entry (filter, name);
+  g_free (name);
+
+  if (!filter->zip_descriptor && !filter->zip_selected) {
+    filter->zip_state = GZDEC_ZIP_SKIP;
+  } else if (method == ZIP_METHOD_DEFLATE) {
+    /* raw deflate data, its end is found by inflate itself */
+    inflateReset2 (&filter->strm, -MAX_WBITS);
+    filter->zip_state = GZDEC_ZIP_DEFLATE;
+  } else if (method == ZIP_METHOD_STORED && !filter->zip_descriptor) {
+    filter->zip_state = GZDEC_ZIP_STORED;
+  } else {
+    GST_ELEMENT_ERROR (filter, STREAM, DEMUX, (NULL),
+        ("Zip entry of unknown size can not be extracted"));
+    return GST_FLOW_ERROR;
+  }
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+gst_gzdec_zip_parse (Gstgzdec * filter, GstBuffer * inbuf)
+{
+  GstAdapter *adapter = filter->zip_adapter;
+  GstFlowReturn flow = GST_FLOW_OK;
+  GzdecZipState state;
+  const guint8 *data;
+  gsize avail, size;
+
+  gst_adapter_push (adapter, inbuf);
+
+  while (flow == GST_FLOW_OK) {
+    avail = gst_adapter_available (adapter);
+    state = filter->zip_state;
+
+    switch (state) {
+      case GZDEC_ZIP_HEADER:
+        flow = gst_gzdec_zip_header (filter);
+        if (flow == GST_FLOW_OK && filter->zip_state == GZDEC_ZIP_HEADER)
+          return flow;
+        break;
+      case GZDEC_ZIP_DEFLATE:
+        size = filter->zip_descriptor ? avail :
+            MIN (avail, filter->zip_remaining);
+        if (size == 0)
+          return flow;
+        data = gst_adapter_map (adapter, size);
+        flow = gst_gzdec_inflate (filter, data, size);
+        gst_adapter_unmap (adapter);
+        size -= filter->strm.avail_in;
+        gst_adapter_flush (adapter, size);
+        if (!filter->zip_descriptor)
+          filter->zip_remaining -= size;
+
+        if (flow != GST_FLOW_OK)
+          break;
+        if (filter->stream_end) {
+          if (filter->zip_selected)
+            flow = gst_gzdec_end_entry (filter);
+          filter->zip_state = filter->zip_descriptor ?
+              GZDEC_ZIP_DESCRIPTOR : GZDEC_ZIP_HEADER;
+        } else if (!filter->zip_descriptor && filter->zip_remaining == 0) {
+          GST_ELEMENT_ERROR (filter, STREAM, DECODE, (NULL),
+              ("Truncated zip entry"));
+          flow = GST_FLOW_ERROR;
+        } else if (size == 0) {
+          return flow;
+        }
+        break;
+      case GZDEC_ZIP_STORED:
+      case GZDEC_ZIP_SKIP:
+        size = MIN (avail, filter->zip_remaining);
+        if (size == 0 && filter->zip_remaining > 0)
+          return flow;
+        if (size > 0 && state == GZDEC_ZIP_STORED) {
+          flow = gst_gzdec_push_data (filter,
+              gst_adapter_take_buffer_fast (adapter, size));
+        } else if (size > 0) {
+          gst_adapter_flush (adapter, size);
+        }
+        filter->zip_remaining -= size;
+        if (filter->zip_remaining == 0) {
+          if (flow == GST_FLOW_OK && state == GZDEC_ZIP_STORED)
+            flow = gst_gzdec_end_entry (filter);
+          filter->zip_state = GZDEC_ZIP_HEADER;
+        }
+        break;
+      case GZDEC_ZIP_DESCRIPTOR:
+        /* crc and sizes, with an optional signature */
+        size = filter->zip64 ? 20 : 12;
+        if (avail < 4)
+          return flow;
+        data = gst_adapter_map (adapter, 4);
+        if (GST_READ_UINT32_LE (data) == ZIP_DATA_DESCRIPTOR_SIG)
+          size += 4;
+        gst_adapter_unmap (adapter);
+        if (avail < size)
+          return flow;
+        gst_adapter_flush (adapter, size);
+        filter->zip_state = GZDEC_ZIP_HEADER;
+        break;
+      case GZDEC_ZIP_END:
+        gst_adapter_clear (adapter);
+        return flow;
+    }
+  }
+
+  return flow;
+}
+
+/* random access to zip archives
+ *
+ * When upstream is seekable in pull mode, the sink pad drives the pipeline
+ * from its own task. The central directory at the end of the archive is
+ * read first, then only the local headers and data of the selected
+ * entries are pulled, so extracting one entry does not read the others.
+ */
+static void
+gst_gzdec_zip_entry_clear (GzdecZipEntry * entry)
+{
+  g_free (entry->name);
+}
+
+/* pull exactly @size bytes, the directory tells where everything is */
+static GstFlowReturn
+gst_gzdec_zip_pull (Gstgzdec * filter, guint64 offset, guint size,
+    GstBuffer ** buf)
+{
+  GstFlowReturn flow;
+
+  *buf = NULL;
+  flow = gst_pad_pull_range (filter->sinkpad, offset, size, buf);
+  if (flow == GST_FLOW_OK && gst_buffer_get_size (*buf) < size) {
+    gst_clear_buffer (buf);
+    flow = GST_FLOW_EOS;
+  }
+
+  if (flow == GST_FLOW_EOS) {
+    GST_ELEMENT_ERROR (filter, STREAM, DEMUX, (NULL),
+        ("Truncated zip archive"));
+    return GST_FLOW_ERROR;
+  }
+
+  return flow;
+}
+
+/* find the central directory from the end of central directory record,
+ * or its ZIP64 version */
+static GstFlowReturn
+gst_gzdec_zip_find_directory (Gstgzdec * filter, guint64 * cd_offset,
+    guint64 * cd_size)
+{
+  guint8 zip64[ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE];
+  const guint8 *eocd = NULL;
+  guint64 zip64_offset = 0;
+  GstFlowReturn flow;
+  GstMapInfo map;
+  GstBuffer *buf;
+  gint64 size;
+  gsize i, tail_size;
+
+  if (!gst_pad_peer_query_duration (filter->sinkpad, GST_FORMAT_BYTES, &size)
+      || size < ZIP_END_OF_CENTRAL_DIRECTORY_SIZE) {
+    GST_ELEMENT_ERROR (filter, STREAM, DEMUX, (NULL),
+        ("Unable to find the zip central directory"));
+    return GST_FLOW_ERROR;
+  }
+
+  /* the record ends the archive, followed by a comment of up to 64K */
+  tail_size = MIN (size, ZIP_END_OF_CENTRAL_DIRECTORY_SIZE + G_MAXUINT16);
+  flow = gst_gzdec_zip_pull (filter, size - tail_size, tail_size, &buf);
+  if (flow != GST_FLOW_OK)
+    return flow;
+
+  if (!gst_buffer_map (buf, &map, GST_MAP_READ)) {
+    gst_buffer_unref (buf);
+    GST_ELEMENT_ERROR (filter, STREAM, FAILED, (NULL),
+        ("Unable to map the input buffer"));
+    return GST_FLOW_ERROR;
+  }
+
+  for (i = tail_size - ZIP_END_OF_CENTRAL_DIRECTORY_SIZE + 1; i > 0; i--) {
+    if (GST_READ_UINT32_LE (map.data + i - 1) ==
+        ZIP_END_OF_CENTRAL_DIRECTORY_SIG) {
+      eocd = map.data + i - 1;
+      break;
+    }
+  }
+
+  if (eocd) {
+    *cd_size = GST_READ_UINT32_LE (eocd + 12);
+    *cd_offset = GST_READ_UINT32_LE (eocd + 16);
+
+    if ((*cd_size == G_MAXUINT32 || *cd_offset == G_MAXUINT32) &&
+        eocd - map.data >= ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE &&
+        GST_READ_UINT32_LE (eocd - ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE)
+        == ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIG)
+      zip64_offset = GST_READ_UINT64_LE (eocd -
+          ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE + 8);
+  }
+
+  gst_buffer_unmap (buf, &map);
+  gst_buffer_unref (buf);
+
+  if (!eocd) {
+    GST_ELEMENT_ERROR (filter, STREAM, DEMUX, (NULL),
+        ("Unable to find the zip central directory"));
+    return GST_FLOW_ERROR;
+  }
+
+  if (zip64_offset > 0) {
+    flow = gst_gzdec_zip_pull (filter, zip64_offset,
+        ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE, &buf);
+    if (flow != GST_FLOW_OK)
+      return flow;
+    gst_buffer_extract (buf, 0, zip64, sizeof (zip64));
+    gst_buffer_unref (buf);
+
+    if (GST_READ_UINT32_LE (zip64) == ZIP64_END_OF_CENTRAL_DIRECTORY_SIG) {
+      *cd_size = GST_READ_UINT64_LE (zip64 + 40);
+      *cd_offset = GST_READ_UINT64_LE (zip64 + 48);
+    }
+  }
+
+  if (*cd_offset > (guint64) size || *cd_size > (guint64) size - *cd_offset ||
+      *cd_size > GZDEC_ZIP_MAX_DIRECTORY) {
+    GST_ELEMENT_ERROR (filter, STREAM, DEMUX, (NULL),
+        ("Invalid zip central directory"));
+    return GST_FLOW_ERROR;
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* keep the central directory records of the entries to extract */
+static GstFlowReturn
+gst_gzdec_zip_read_directory (Gstgzdec * filter)
+{
+  guint64 cd_offset, cd_size;
+  const guint8 *data, *end;
+  GstFlowReturn flow;
+  GstMapInfo map;
+  GstBuffer *buf;
+
+  filter->zip_entries = g_array_new (FALSE, FALSE, sizeof (GzdecZipEntry));
+  g_array_set_clear_func (filter->zip_entries,
+      (GDestroyNotify) gst_gzdec_zip_entry_clear);
+  filter->zip_entry_index = 0;
+
+  flow = gst_gzdec_zip_find_directory (filter, &cd_offset, &cd_size);
+  if (flow != GST_FLOW_OK || cd_size == 0)
+    return flow;
+
+  flow = gst_gzdec_zip_pull (filter, cd_offset, cd_size, &buf);
+  if (flow != GST_FLOW_OK)
+    return flow;
+
+  if (!gst_buffer_map (buf, &map, GST_MAP_READ)) {
+    gst_buffer_unref (buf);
+    GST_ELEMENT_ERROR (filter, STREAM, FAILED, (NULL),
+        ("Unable to map the input buffer"));
+    return GST_FLOW_ERROR;
+  }
+
+  data = map.data;
+  end = map.data + map.size;
+  while (data + ZIP_CENTRAL_DIRECTORY_SIZE <= end &&
+      GST_READ_UINT32_LE (data) == ZIP_CENTRAL_DIRECTORY_SIG) {
+    guint flags = GST_READ_UINT16_LE (data + 8);
+    guint method = GST_READ_UINT16_LE (data + 10);
+    guint64 csize = GST_READ_UINT32_LE (data + 20);
+    guint64 usize = GST_READ_UINT32_LE (data + 24);
+    guint name_len = GST_READ_UINT16_LE (data + 28);
+    guint extra_len = GST_READ_UINT16_LE (data + 30);
+    guint comment_len = GST_READ_UINT16_LE (data + 32);
+    guint64 offset = GST_READ_UINT32_LE (data + 42);
+    const guint8 *extra, *extra_end;
+    gchar *raw_name, *name;
+
+    extra = data + ZIP_CENTRAL_DIRECTORY_SIZE + name_len;
+    extra_end = extra + extra_len;
+    if (extra_end + comment_len > end)
+      break;
+
+    /* ZIP64 values are only there for the fields that overflowed */
+    while (extra + 4 <= extra_end) {
+      guint id = GST_READ_UINT16_LE (extra);
+      const guint8 *field = extra + 4;
+      const guint8 *field_end = field + GST_READ_UINT16_LE (extra + 2);
+
+      if (field_end > extra_end)
+        break;
+      if (id == 0x0001) {
+        if (usize == G_MAXUINT32 && field + 8 <= field_end) {
+          usize = GST_READ_UINT64_LE (field);
+          field += 8;
+        }
+        if (csize == G_MAXUINT32 && field + 8 <= field_end) {
+          csize = GST_READ_UINT64_LE (field);
+          field += 8;
+        }
+        if (offset == G_MAXUINT32 && field + 8 <= field_end)
+          offset = GST_READ_UINT64_LE (field);
+      }
+      extra = field_end;
+    }
+
+    raw_name = g_strndup ((const gchar *) data + ZIP_CENTRAL_DIRECTORY_SIZE,
+        name_len);
+    name = gst_gzdec_entry_name_to_utf8 (raw_name,
+        (flags & ZIP_FLAG_UTF8) ? "UTF-8" : "CP437");
+    g_free (raw_name);
+
+    GST_DEBUG_OBJECT (filter, "Zip entry %s at %" G_GUINT64_FORMAT
+        ", method %u, flags 0x%04x, %" G_GUINT64_FORMAT " -> %"
+        G_GUINT64_FORMAT " bytes", name, offset, method, flags, csize, usize);
+
+    if ((method == ZIP_METHOD_STORED || method == ZIP_METHOD_DEFLATE) &&
+        !(flags & ZIP_FLAG_ENCRYPTED) && !g_str_has_suffix (name, "/") &&
+        gst_gzdec_match_entry (filter, name)) {
+      GzdecZipEntry entry = { name, method, csize, offset };
+
+      g_array_append_val (filter->zip_entries, entry);
+    } else {
+      GST_DEBUG_OBJECT (filter, "Skipping entry %s", name);
+      g_free (name);
+    }
+
+    data = extra_end + comment_len;
+  }
+
+  gst_buffer_unmap (buf, &map);
+  gst_buffer_unref (buf);
+
+  GST_DEBUG_OBJECT (filter, "%u zip entries to extract",
+      filter->zip_entries->len);
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+gst_gzdec_zip_open_entry (Gstgzdec * filter)
+{
+  guint8 header[ZIP_LOCAL_HEADER_SIZE];
+  GzdecZipEntry *entry;
+  GstFlowReturn flow;
+  GstBuffer *buf;
+
+  if (filter->zip_entry_index >= filter->zip_entries->len)
+    return GST_FLOW_EOS;
+
+  entry = &g_array_index (filter->zip_entries, GzdecZipEntry,
+      filter->zip_entry_index);
+  filter->zip_entry_index++;
+
+  flow = gst_gzdec_zip_pull (filter, entry->offset, ZIP_LOCAL_HEADER_SIZE,
+      &buf);
+  if (flow != GST_FLOW_OK)
+    return flow;
+  gst_buffer_extract (buf, 0, header, ZIP_LOCAL_HEADER_SIZE);
+  gst_buffer_unref (buf);
+
+  if (GST_READ_UINT32_LE (header) != ZIP_LOCAL_HEADER_SIG) {
+    GST_ELEMENT_ERROR (filter, STREAM, DEMUX, (NULL),
+        ("Invalid zip local header signature 0x%08x",
+            GST_READ_UINT32_LE (header)));
+    return GST_FLOW_ERROR;
+  }
+
+  /* the local name and extra field may differ from the central ones */
+  filter->zip_offset = entry->offset + ZIP_LOCAL_HEADER_SIZE +
+      GST_READ_UINT16_LE (header + 26) + GST_READ_UINT16_LE (header + 28);
+  filter->zip_remaining = entry->csize;
+  filter->zip_method = entry->method;
+  filter->zip_selected = TRUE;
+  gst_gzdec_announce_entry (filter, entry->name);
+
+  if (entry->method == ZIP_METHOD_DEFLATE) {
+    inflateReset2 (&filter->strm, -MAX_WBITS);
+    filter->stream_end = FALSE;
+    filter->zip_state = GZDEC_ZIP_DEFLATE;
+  } else {
+    filter->zip_state = GZDEC_ZIP_STORED;
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* pull and extract one more block of the current entry */
+static GstFlowReturn
+gst_gzdec_zip_read_entry (Gstgzdec * filter)
+{
+  GstFlowReturn flow = GST_FLOW_OK;
+  GstBuffer *buf;
+  GstMapInfo map;
+  gsize size, out_bytes;
+
+  if (filter->zip_remaining > 0) {
+    size = MIN (filter->zip_remaining, GZDEC_PULL_BLOCK_SIZE);
+    flow = gst_gzdec_zip_pull (filter, filter->zip_offset, size, &buf);
+    if (flow != GST_FLOW_OK)
+      return flow;
+
+    out_bytes = filter->output_bytes;
+    GZDEC_PROBE2 (buffer__enter, filter, size);
+    filter->input_bytes += size;
+
+    if (filter->zip_state == GZDEC_ZIP_STORED) {
+      filter->zip_offset += size;
+      filter->zip_remaining -= size;
+      flow = gst_gzdec_push_data (filter, buf);
+    } else if (gst_buffer_map (buf, &map, GST_MAP_READ)) {
+      flow = gst_gzdec_inflate (filter, map.data, size);
+      filter->zip_offset += size - filter->strm.avail_in;
+      filter->zip_remaining -= size - filter->strm.avail_in;
+      gst_buffer_unmap (buf, &map);
+      gst_buffer_unref (buf);
+    } else {
+      gst_buffer_unref (buf);
+      GST_ELEMENT_ERROR (filter, STREAM, FAILED, (NULL),
+          ("Unable to map the input buffer"));
+      flow = GST_FLOW_ERROR;
+    }
+
+    GZDEC_PROBE3 (buffer__exit, filter, size,
+        filter->output_bytes - out_bytes);
+    if (flow != GST_FLOW_OK)
+      return flow;
+  }
+
+  if (filter->zip_state == GZDEC_ZIP_DEFLATE && !filter->stream_end) {
+    if (filter->zip_remaining > 0)
+      return GST_FLOW_OK;
+    GST_ELEMENT_ERROR (filter, STREAM, DECODE, (NULL),
+        ("Truncated zip entry"));
+    return GST_FLOW_ERROR;
+  }
+  if (filter->zip_state == GZDEC_ZIP_STORED && filter->zip_remaining > 0)
+    return GST_FLOW_OK;
+
+  filter->zip_state = GZDEC_ZIP_HEADER;
+  return gst_gzdec_end_entry (filter);
+}
+
+static GstFlowReturn
+gst_gzdec_zip_start (Gstgzdec * filter)
+{
+  GstSegment segment;
+  gchar *stream_id;
+
+  /* nothing is pushed from upstream in pull mode, not even the events */
+  gst_gzdec_reset (filter);
+  filter->format = GZDEC_FORMAT_ZIP;
+
+  stream_id = gst_pad_create_stream_id (filter->srcpad, GST_ELEMENT (filter),
+      NULL);
+  gst_pad_push_event (filter->srcpad, gst_event_new_stream_start (stream_id));
+  g_free (stream_id);
+
+  gst_segment_init (&segment, GST_FORMAT_BYTES);
+  filter->pending_segment = gst_event_new_segment (&segment);
+
+  return gst_gzdec_zip_read_directory (filter);
+}
+
+static void
+gst_gzdec_zip_loop (GstPad * pad)
+{
+  Gstgzdec *filter = GST_GZDEC (GST_PAD_PARENT (pad));
+  GstFlowReturn flow;
+
+  if (!filter->zip_entries)
+    flow = gst_gzdec_zip_start (filter);
+  else if (filter->zip_state == GZDEC_ZIP_HEADER)
+    flow = gst_gzdec_zip_open_entry (filter);
+  else
+    flow = gst_gzdec_zip_read_entry (filter);
+
+  if (flow == GST_FLOW_OK)
+    return;
+
+  GST_DEBUG_OBJECT (filter, "Pausing task, reason %s",
+      gst_flow_get_name (flow));
+  gst_pad_pause_task (pad);
+  gst_gzdec_inflate_end (filter);
+
+  if (flow == GST_FLOW_EOS) {
+    gst_gzdec_drain (filter);
+    gst_pad_push_event (filter->srcpad, gst_event_new_eos ());
+  } else if (flow == GST_FLOW_NOT_LINKED || flow < GST_FLOW_EOS) {
+    GST_ELEMENT_FLOW_ERROR (filter, flow);
+    gst_pad_push_event (filter->srcpad, gst_event_new_eos ());
+  }
+}
+
+/* pull mode
+ *
+ * Downstream pulls decoded ranges from the src pad and gzdec pulls the
+ * compressed data it needs from upstream. The decoded data is kept in a
+ * small cache, and the inflate state is saved every
+ * GZDEC_CHECKPOINT_SPACING decoded bytes so requests going backwards only
+ * decode again from the closest checkpoint instead of from the start.
+ */
+static gboolean
+gst_gzdec_upstream_seekable (Gstgzdec * filter)
+{
+  GstQuery *query;
+  gboolean pull;
+
+  query = gst_query_new_scheduling ();
+  pull = gst_pad_peer_query (filter->sinkpad, query) &&
+      gst_query_has_scheduling_mode_with_flags (query, GST_PAD_MODE_PULL,
+      GST_SCHEDULING_FLAG_SEEKABLE);
+  gst_query_unref (query);
+
+  return pull;
+}
+
+/* peek at the magic of the data upstream, with the sink pad in pull mode */
+static gboolean
+gst_gzdec_upstream_is_zip (Gstgzdec * filter)
+{
+  GstBuffer *buf = NULL;
+  guint8 magic[4];
+  gboolean zip;
+
+  if (gst_pad_pull_range (filter->sinkpad, 0, sizeof (magic), &buf) !=
+      GST_FLOW_OK)
+    return FALSE;
+
+  zip = gst_buffer_extract (buf, 0, magic, sizeof (magic)) == sizeof (magic)
+      && GST_READ_UINT32_LE (magic) == ZIP_LOCAL_HEADER_SIG;
+  gst_buffer_unref (buf);
+
+  return zip;
+}
+
+static gboolean
+gst_gzdec_pull_supported (Gstgzdec * filter)
+{
+  /* only plain gzip/zlib streams map to a single decoded byte range */
+  if (filter->tar || filter->record_delimiter >= 0 ||
+      filter->passthrough_uncompressed ||
+      filter->format == GZDEC_FORMAT_ZIP)
+    return FALSE;
+
+  return gst_gzdec_upstream_seekable (filter);
+}
+
+static void
+gst_gzdec_checkpoint_free (GzdecCheckpoint * point)
+{
+  inflateEnd (&point->strm);
+  g_free (point);
+}
+
+static gboolean
+gst_gzdec_pull_checkpoint (Gstgzdec * filter)
+{
+  GzdecCheckpoint *point = g_new0 (GzdecCheckpoint, 1);
+
+  if (inflateCopy (&point->strm, &filter->strm) != Z_OK) {
+    g_free (point);
+    return FALSE;
+  }
+  point->in_offset = filter->pull_in_offset;
+  point->out_offset = filter->pull_out_offset;
+  g_ptr_array_add (filter->checkpoints, point);
+
+  GST_DEBUG_OBJECT (filter, "Checkpoint at %" G_GUINT64_FORMAT " -> %"
+      G_GUINT64_FORMAT, point->in_offset, point->out_offset);
+  return TRUE;
+}
+
+static gboolean
+gst_gzdec_pull_start (Gstgzdec * filter)
+{
+  /* a zip archive is not one decoded byte range, its entries are pushed */
+  if (gst_gzdec_upstream_is_zip (filter)) {
+    GST_DEBUG_OBJECT (filter, "Refusing pull mode for a zip archive");
+    return FALSE;
+  }
+
+  gst_gzdec_inflate_end (filter);
+  memset (&filter->strm, 0, sizeof (filter->strm));
+  if (inflateInit2 (&filter->strm, 32) != Z_OK)
+    return FALSE;
+
+  filter->initialized = TRUE;
+  filter->format = GZDEC_FORMAT_ZLIB;
+  filter->stream_end = FALSE;
+  filter->pull_in_offset = 0;
+  filter->pull_out_offset = 0;
+  gst_adapter_clear (filter->pull_cache);
+  g_ptr_array_set_size (filter->checkpoints, 0);
+
+  return gst_gzdec_pull_checkpoint (filter);
+}
+
+static void
+gst_gzdec_pull_stop (Gstgzdec * filter)
+{
+  gst_adapter_clear (filter->pull_cache);
+  g_ptr_array_set_size (filter->checkpoints, 0);
+  gst_gzdec_inflate_end (filter);
+}
+
+/* restart decoding from the last checkpoint before @offset */
+static gboolean
+gst_gzdec_pull_rewind (Gstgzdec * filter, guint64 offset)
+{
+  GzdecCheckpoint *point = g_ptr_array_index (filter->checkpoints, 0);
+  guint i;
+
+  for (i = 1; i < filter->checkpoints->len; i++) {
+    GzdecCheckpoint *next = g_ptr_array_index (filter->checkpoints, i);
+
+    if (next->out_offset > offset)
+      break;
+    point = next;
+  }
+
+  GST_DEBUG_OBJECT (filter, "Rewinding to %" G_GUINT64_FORMAT " for %"
+      G_GUINT64_FORMAT, point->out_offset, offset);
+
+  gst_gzdec_inflate_end (filter);
+  if (inflateCopy (&filter->strm, &point->strm) != Z_OK)
+    return FALSE;
+  filter->initialized = TRUE;
+
+  filter->stream_end = FALSE;
+  filter->pull_in_offset = point->in_offset;
+  filter->pull_out_offset = point->out_offset;
+  gst_adapter_clear (filter->pull_cache);
+
+  return TRUE;
+}
+
+/* decode one more block of compressed data into the cache */
+static GstFlowReturn
+gst_gzdec_pull_decode (Gstgzdec * filter)
+{
+  GzdecCheckpoint *last;
+  GstBuffer *inbuf = NULL;
+  GstFlowReturn flow;
+  GstMapInfo map;
+  gsize out_bytes;
+
+  flow = gst_pad_pull_range (filter->sinkpad, filter->pull_in_offset,
+      GZDEC_PULL_BLOCK_SIZE, &inbuf);
+  if (flow != GST_FLOW_OK)
+    return flow;
+
+  if (!gst_buffer_map (inbuf, &map, GST_MAP_READ)) {
+    gst_buffer_unref (inbuf);
+    GST_ELEMENT_ERROR (filter, STREAM, FAILED, (NULL),
+        ("Unable to map the input buffer"));
+    return GST_FLOW_ERROR;
+  }
+
+  out_bytes = filter->output_bytes;
+  GZDEC_PROBE2 (buffer__enter, filter, map.size);
+
+  filter->input_bytes += map.size;
+  flow = gst_gzdec_inflate (filter, map.data, map.size);
+  filter->pull_in_offset += map.size - filter->strm.avail_in;
+
+  GZDEC_PROBE3 (buffer__exit, filter, map.size,
+      filter->output_bytes - out_bytes);
+  gst_buffer_unmap (inbuf, &map);
+  gst_buffer_unref (inbuf);
+
+  last = g_ptr_array_index (filter->checkpoints,
+      filter->checkpoints->len - 1);
+  /* after a rewind the data before the last checkpoint is decoded again,
+   * the checkpoints only move forward so they stay sorted */
+  if (flow == GST_FLOW_OK && !filter->stream_end &&
+      filter->pull_out_offset >= last->out_offset + GZDEC_CHECKPOINT_SPACING)
+    gst_gzdec_pull_checkpoint (filter);
+
+  return flow;
+}
+
+static GstFlowReturn
+gst_gzdec_src_getrange (GstPad * pad, GstObject * parent, guint64 offset,
+    guint length, GstBuffer ** buffer)
+{
+  Gstgzdec *filter = GST_GZDEC (parent);
+  GstFlowReturn flow = GST_FLOW_OK;
+  guint64 cache_start;
+  GstBufferList *list;
+  gsize avail, skip, remaining;
+  guint i;
+
+  avail = gst_adapter_available (filter->pull_cache);
+  if (offset < filter->pull_out_offset - avail &&
+      !gst_gzdec_pull_rewind (filter, offset)) {
+    GST_ELEMENT_ERROR (filter, STREAM, DECODE, (NULL),
+        ("Unable to restore the inflate state"));
+    return GST_FLOW_ERROR;
+  }
+
+  while (filter->pull_out_offset < offset + length && !filter->stream_end) {
+    flow = gst_gzdec_pull_decode (filter);
+    if (flow != GST_FLOW_OK)
+      break;
+
+    /* only keep GZDEC_PULL_CACHE_SIZE bytes before the requested range */
+    avail = gst_adapter_available (filter->pull_cache);
+    cache_start = filter->pull_out_offset - avail;
+    if (avail > GZDEC_PULL_CACHE_SIZE && cache_start < offset)
+      gst_adapter_flush (filter->pull_cache,
+          MIN (avail - GZDEC_PULL_CACHE_SIZE, offset - cache_start));
+  }
+
+  /* a truncated stream just ends where the compressed data does */
+  if (flow != GST_FLOW_OK && flow != GST_FLOW_EOS)
+    return flow;
+  if (offset >= filter->pull_out_offset)
+    return GST_FLOW_EOS;
+
+  length = MIN (length, filter->pull_out_offset - offset);
+  cache_start = filter->pull_out_offset -
+      gst_adapter_available (filter->pull_cache);
+
+  /* share the memories of the cache rather than copying them out */
+  skip = offset - cache_start;
+  remaining = length;
+  list = gst_adapter_get_buffer_list (filter->pull_cache, skip + length);
+  *buffer = gst_buffer_new ();
+  for (i = 0; i < gst_buffer_list_length (list) && remaining > 0; i++) {
+    GstBuffer *buf = gst_buffer_list_get (list, i);
+    gsize size = gst_buffer_get_size (buf);
+
+    if (skip >= size) {
+      skip -= size;
+      continue;
+    }
+    size = MIN (size - skip, remaining);
+    *buffer = gst_buffer_append (*buffer,
+        gst_buffer_copy_region (buf, GST_BUFFER_COPY_MEMORY, skip, size));
+    remaining -= size;
+    skip = 0;
+  }
+  gst_buffer_list_unref (list);
+
+  GST_BUFFER_OFFSET (*buffer) = offset;
+  GST_BUFFER_OFFSET_END (*buffer) = offset + length;
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+gst_gzdec_src_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  Gstgzdec *filter = GST_GZDEC (parent);
+
+  if (mode != GST_PAD_MODE_PULL)
+    return TRUE;
+
+  if (active) {
+    if (!gst_gzdec_pull_supported (filter) ||
+        !gst_pad_activate_mode (filter->sinkpad, GST_PAD_MODE_PULL, TRUE))
+      return FALSE;
+    if (gst_gzdec_pull_start (filter))
+      return TRUE;
+    gst_pad_activate_mode (filter->sinkpad, GST_PAD_MODE_PULL, FALSE);
+    return FALSE;
+  }
+
+  gst_gzdec_pull_stop (filter);
+  return gst_pad_activate_mode (filter->sinkpad, GST_PAD_MODE_PULL, FALSE);
+}
+
+/* zip archives are read through their central directory when upstream
+ * allows it, everything else is decoded as it is pushed */
+static gboolean
+gst_gzdec_sink_activate (GstPad * pad, GstObject * parent)
+{
+  Gstgzdec *filter = GST_GZDEC (parent);
+
+  if (gst_gzdec_upstream_seekable (filter) &&
+      gst_pad_activate_mode (pad, GST_PAD_MODE_PULL, TRUE)) {
+    if (gst_gzdec_upstream_is_zip (filter)) {
+      GST_DEBUG_OBJECT (filter, "Reading the zip archive in pull mode");
+      /* the directory is read again by the task */
+      g_clear_pointer (&filter->zip_entries, g_array_unref);
+      return gst_pad_start_task (pad, (GstTaskFunction) gst_gzdec_zip_loop,
+          pad, NULL);
+    }
+    gst_pad_activate_mode (pad, GST_PAD_MODE_PULL, FALSE);
+  }
+
+  return gst_pad_activate_mode (pad, GST_PAD_MODE_PUSH, TRUE);
+}
+
+static gboolean
+gst_gzdec_sink_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  Gstgzdec *filter = GST_GZDEC (parent);
+
+  if (mode == GST_PAD_MODE_PULL && !active) {
+    if (!gst_pad_stop_task (pad))
+      return FALSE;
+    gst_gzdec_inflate_end (filter);
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_gzdec_src_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  Gstgzdec *filter = GST_GZDEC (parent);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_SCHEDULING:
+    {
+      gboolean pull = gst_gzdec_pull_supported (filter);
+
+      gst_query_set_scheduling (query,
+          pull ? GST_SCHEDULING_FLAG_SEEKABLE : 0, 1, -1, 0);
+      gst_query_add_scheduling_mode (query, GST_PAD_MODE_PUSH);
+      if (pull)
+        gst_query_add_scheduling_mode (query, GST_PAD_MODE_PULL);
+      return TRUE;
+    }
+    case GST_QUERY_SEEKING:
+    {
+      GstFormat format;
+
+      /* decoded ranges can only be pulled, pushed data is not seekable */
+      gst_query_parse_seeking (query, &format, NULL, NULL, NULL);
+      if (format != GST_FORMAT_BYTES)
+        return gst_pad_query_default (pad, parent, query);
+      gst_query_set_seeking (query, format,
+          GST_PAD_MODE (pad) == GST_PAD_MODE_PULL, 0, -1);
+      return TRUE;
+    }
+    case GST_QUERY_POSITION:
+    {
+      GstFormat format;
+
+      /* upstream would answer with the compressed position */
+      gst_query_parse_position (query, &format, NULL);
+      if (format != GST_FORMAT_BYTES)
+        return gst_pad_query_default (pad, parent, query);
+      if (GST_PAD_MODE (pad) == GST_PAD_MODE_PULL)
+        return FALSE;
+      gst_query_set_position (query, format, filter->output_bytes);
+      return TRUE;
+    }
+    case GST_QUERY_DURATION:
+    {
+      GstFormat format;
+
+      /* upstream would answer with the compressed size */
+      gst_query_parse_duration (query, &format, NULL);
+      if (format == GST_FORMAT_BYTES)
+        return FALSE;
+      return gst_pad_query_default (pad, parent, query);
+    }
+    default:
+      return gst_pad_query_default (pad, parent, query);
+  }
+}
+
+static gboolean
+gst_gzdec_src_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  if (GST_EVENT_TYPE (event) == GST_EVENT_SEEK) {
+    GstFormat format;
+
+    /* upstream would seek in the compressed data */
+    gst_event_parse_seek (event, NULL, &format, NULL, NULL, NULL, NULL, NULL);
+    if (format == GST_FORMAT_BYTES) {
+      GST_DEBUG_OBJECT (parent, "Refusing seek in bytes");
+      gst_event_unref (event);
+      return FALSE;
+    }
+  }
+
+  return gst_pad_event_default (pad, parent, event);
+}
+
+/* look at the magic bytes of the stream */
+static GzdecFormat
+gst_gzdec_detect_format (Gstgzdec * filter, const guint8 * magic, gsize size)
+{
+  if (size == 4 && GST_READ_UINT32_LE (magic) == ZIP_LOCAL_HEADER_SIG) {
+    GST_DEBUG_OBJECT (filter, "Zip archive detected");
+    return GZDEC_FORMAT_ZIP;
+  }
+
+  if (!filter->passthrough_uncompressed)
+    return GZDEC_FORMAT_ZLIB;
+
+  /* gzip member header, deflate method */
+  if (size >= 3 && magic[0] == 0x1f && magic[1] == 0x8b && magic[2] == 8)
+    return GZDEC_FORMAT_ZLIB;
+
+  /* zlib header: deflate method, window up to 32K and check bits. Plain
+   * text like "x^" matches it too, so without a preset dictionary the
+   * first deflate block type must be valid as well. Input that still does
+   * not inflate is passed through by gst_gzdec_inflate() */
+  if (size >= 2 && (magic[0] & 0x0f) == 8 && (magic[0] >> 4) <= 7 &&
+      GST_READ_UINT16_BE (magic) % 31 == 0 &&
+      (size < 3 || (magic[1] & 0x20) || ((magic[2] >> 1) & 3) != 3))
+    return GZDEC_FORMAT_ZLIB;
+
+  GST_DEBUG_OBJECT (filter, "Input is not compressed, passing it through");
+  return GZDEC_FORMAT_PLAIN;
+}
+
+/* push the input kept since the start of a stream that did not inflate */
+static GstFlowReturn
+gst_gzdec_pass_through (Gstgzdec * filter)
+{
+  GstFlowReturn flow = GST_FLOW_OK;
+  GList *buffers, *l;
+
+  buffers = gst_adapter_take_list (filter->detect_adapter,
+      gst_adapter_available (filter->detect_adapter));
+  for (l = buffers; l; l = l->next) {
+    if (flow == GST_FLOW_OK)
+      flow = gst_gzdec_push_output (filter, l->data);
+    else
+      gst_buffer_unref (l->data);
+  }
+  g_list_free (buffers);
+
+  return flow;
+}
+
+static GstFlowReturn
+gst_gzdec_process (Gstgzdec * filter, GstBuffer * buf)
+{
+  GstFlowReturn flow;
+
+  if (filter->format == GZDEC_FORMAT_PLAIN) {
+    flow = gst_gzdec_push_output (filter, buf);
+  } else if (filter->format == GZDEC_FORMAT_ZIP) {
+    flow = gst_gzdec_zip_parse (filter, buf);
+  } else {
+    /* until something is decoded, keep the input to pass it through if it
+     * turns out not to be compressed */
+    if (filter->passthrough_uncompressed && filter->strm.total_out == 0)
+      gst_adapter_push (filter->detect_adapter, gst_buffer_ref (buf));
+    flow = gst_gzdec_decompress (filter, buf);
+    gst_buffer_unref (buf);
+
+    if (filter->format == GZDEC_FORMAT_PLAIN)
+      flow = gst_gzdec_pass_through (filter);
+    else if (filter->strm.total_out > 0)
+      gst_adapter_clear (filter->detect_adapter);
+  }
+
+  return flow;
+}
+
+/* the input is held until its first 4 bytes, or the end of the stream,
+ * tell its format. The held buffers are then processed untouched */
+static GstFlowReturn
+gst_gzdec_detect (Gstgzdec * filter, gboolean eos)
+{
+  GstFlowReturn flow = GST_FLOW_OK;
+  gsize avail = gst_adapter_available (filter->detect_adapter);
+  guint8 magic[4];
+  GList *buffers, *l;
+
+  if (avail == 0 || (avail < sizeof (magic) && !eos))
+    return GST_FLOW_OK;
+
+  gst_adapter_copy (filter->detect_adapter, magic, 0,
+      MIN (avail, sizeof (magic)));
+  filter->format = gst_gzdec_detect_format (filter, magic,
+      MIN (avail, sizeof (magic)));
+
+  buffers = gst_adapter_take_list (filter->detect_adapter, avail);
+  for (l = buffers; l; l = l->next) {
+    if (flow == GST_FLOW_OK)
+      flow = gst_gzdec_process (filter, l->data);
+    else
+      gst_buffer_unref (l->data);
+  }
+  g_list_free (buffers);
+
+  return flow;
+}
+
+/* chain function
+ * this function does the actual processing
+ */
+static GstFlowReturn
+gst_gzdec_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+{
+  Gstgzdec *filter;
+  GstFlowReturn flow;
+  gsize in_size, out_bytes;
+
+  filter = GST_GZDEC (parent);
+  if (filter->initialized == FALSE) {
+    GST_ERROR("Processing is not possible. Decoder it is not initialized");
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+
+  in_size = gst_buffer_get_size (buf);
+  out_bytes = filter->output_bytes;
+  GZDEC_PROBE2 (buffer__enter, filter, in_size);
+
+  filter->input_bytes += in_size;
+
+  if (filter->format == GZDEC_FORMAT_UNKNOWN) {
+    gst_adapter_push (filter->detect_adapter, buf);
+    flow = gst_gzdec_detect (filter, FALSE);
+  } else {
+    flow = gst_gzdec_process (filter, buf);
   }
 
-  return gst_pad_push (filter->srcpad, outbuf);
+  GZDEC_PROBE3 (buffer__exit, filter, in_size,
+      filter->output_bytes - out_bytes);
+  return flow;
 }
 
 
@@ -48,6 +48,7 @@
 #define __GST_GZDEC_H__
 
 #include <gst/gst.h>
+#include <gst/base/gstadapter.h>
 
 G_BEGIN_DECLS
 
@@ -55,6 +56,48 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (Gstgzdec, gst_gzdec,
     GST, GZDEC, GstElement)
 
+typedef enum
+{
+  GZDEC_TAR_HEADER,
+  GZDEC_TAR_LONG_HEADER,
+  GZDEC_TAR_DATA,
+  GZDEC_TAR_PADDING,
+  GZDEC_TAR_END
+} GzdecTarState;
+
+typedef enum
+{
+  GZDEC_ZIP_HEADER,
+  GZDEC_ZIP_DEFLATE,
+  GZDEC_ZIP_STORED,
+  GZDEC_ZIP_SKIP,
+  GZDEC_ZIP_DESCRIPTOR,
+  GZDEC_ZIP_END
+} GzdecZipState;
+
+typedef enum
+{
+  GZDEC_FORMAT_UNKNOWN,
+  GZDEC_FORMAT_ZLIB,
+  GZDEC_FORMAT_ZIP,
+  GZDEC_FORMAT_PLAIN
+} GzdecFormat;
+
+/* central directory record of a zip entry to extract */
+typedef struct
+{
+  gchar *name;
+  guint method;
+  guint64 csize, offset;
+} GzdecZipEntry;
+
+/* inflate state saved at a position of the stream in pull mode */
+typedef struct
+{
+  guint64 in_offset, out_offset;
+  z_stream strm;
+} GzdecCheckpoint;
+
 struct _Gstgzdec
 {
   GstElement element;
@@ -67,6 +110,75 @@ struct _Gstgzdec
 
   gsize input_bytes, output_bytes;
 
+  /* container detected from the first bytes, held meanwhile */
+  GzdecFormat format;
+  GstAdapter *detect_adapter;
+  gboolean passthrough_uncompressed;
+
+  /* files registered as preset dictionaries */
+  gchar *dictionaries;
+
+  /* output buffers are cut after this byte, -1 when disabled */
+  gint record_delimiter;
+  /* decoded data after the last delimiter, waiting for the next buffer */
+  GstBuffer *record_tail;
+  /* the start of the current record was pushed, it was too long to hold */
+  gboolean record_split;
+
+  /* archive entries to extract */
+  gchar *entry_filter;
+  GPatternSpec *entry_pattern;
+  gchar *entry;
+  /* name of the entry being extracted, hints its type */
+  gchar *entry_name;
+
+  /* tar demuxing of the decoded data */
+  gboolean tar;
+  GstAdapter *tar_adapter;
+  GzdecTarState tar_state;
+  guint64 tar_remaining, tar_padding;
+  gboolean tar_selected;
+  gchar tar_long_header;
+  gchar *tar_long_name;
+
+  /* streaming extraction of zip archives */
+  GstAdapter *zip_adapter;
+  GzdecZipState zip_state;
+  guint64 zip_remaining;
+  guint zip_method;
+  gboolean zip_descriptor, zip64;
+  gboolean zip_selected;
+  /* random access through the central directory in pull mode */
+  GArray *zip_entries;
+  guint zip_entry_index;
+  guint64 zip_offset;
+
+  /* output memories are sliced out of the current block, a chunk of
+   * system memory or a memfd block */
+  gboolean memfd;
+  GstAllocator *fd_allocator;
+  GstMemory *block;
+  guint8 *block_data;
+  gsize block_offset;
+
+  /* src caps are set once the first data is decoded, the segment and tags
+   * received before wait for them */
+  gboolean caps_sent;
+  GstEvent *pending_segment, *pending_tags;
+  /* decoded data held until its type is found */
+  GQueue typefind_held;
+  gsize typefind_size, typefind_tried;
+  gz_header gzip_header;
+  Bytef gzip_name[256];
+
+  /* on demand decoding in pull mode */
+  guint64 pull_in_offset, pull_out_offset;
+  GstAdapter *pull_cache;
+  GPtrArray *checkpoints;
+
+  /* the last inflate() call reached the end of the deflate stream */
+  gboolean stream_end;
+
   z_stream strm;
 };
 
@@ -0,0 +1,1268 @@
+/*
+ * GStreamer
+ * Unit tests for the gzdec element
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <zlib.h>
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+
+/* size of the output chunks gzdec inflates into */
+#define CHUNK_SIZE 16384
+#define DATA_SIZE (1 << 20)
+
+typedef enum
+{
+  DATA_RANDOM,
+  DATA_TEXT,
+  DATA_ZEROS,
+  N_DATA_KINDS
+} DataKind;
+
+/* counting allocator
+ *
+ * Installed as the default allocator, so every gst_allocator_alloc (NULL)
+ * of the element is counted. GstBuffer and GstAdapter merge memories with
+ * a new allocation of the merged size, so merges show up as allocations
+ * bigger than a chunk, and explicit copies go through mem_copy.
+ */
+typedef struct
+{
+  GstMemory mem;
+  guint8 *data;
+} CountMemory;
+
+typedef struct
+{
+  GstAllocator parent;
+} CountAllocator;
+
+typedef struct
+{
+  GstAllocatorClass parent_class;
+} CountAllocatorClass;
+
+GType count_allocator_get_type (void);
+G_DEFINE_TYPE (CountAllocator, count_allocator, GST_TYPE_ALLOCATOR);
+
+static guint n_allocs;
+static gsize max_alloc_size;
+static gsize copied_bytes;
+static gsize reserved_bytes;
+
+static void
+counters_reset (void)
+{
+  n_allocs = 0;
+  max_alloc_size = 0;
+  copied_bytes = 0;
+  reserved_bytes = 0;
+}
+
+static GstMemory *
+count_memory_new (GstAllocator * allocator, GstMemoryFlags flags,
+    GstMemory * parent, guint8 * data, gsize maxsize, gsize offset,
+    gsize size)
+{
+  CountMemory *mem = g_new (CountMemory, 1);
+
+  gst_memory_init (GST_MEMORY_CAST (mem), flags, allocator, parent, maxsize,
+      0, offset, size);
+  mem->data = data;
+
+  return GST_MEMORY_CAST (mem);
+}
+
+static GstMemory *
+count_allocator_alloc (GstAllocator * allocator, gsize size,
+    GstAllocationParams * params)
+{
+  gsize maxsize = params->prefix + size + params->padding;
+
+  n_allocs++;
+  max_alloc_size = MAX (max_alloc_size, size);
+  reserved_bytes += maxsize;
+
+  return count_memory_new (allocator, params->flags, NULL,
+      g_malloc (maxsize), maxsize, params->prefix, size);
+}
+
+static void
+count_allocator_free (GstAllocator * allocator, GstMemory * memory)
+{
+  CountMemory *mem = (CountMemory *) memory;
+
+  if (!memory->parent) {
+    g_free (mem->data);
+    reserved_bytes -= memory->maxsize;
+  }
+  g_free (mem);
+}
+
+static gpointer
+count_memory_map (GstMemory * memory, gsize maxsize, GstMapFlags flags)
+{
+  return ((CountMemory *) memory)->data;
+}
+
+static void
+count_memory_unmap (GstMemory * memory)
+{
+}
+
+static GstMemory *
+count_memory_copy (GstMemory * memory, gssize offset, gssize size)
+{
+  CountMemory *mem = (CountMemory *) memory;
+  guint8 *data;
+
+  if (size == -1)
+    size = memory->size - offset;
+  data = g_malloc (size);
+  memcpy (data, mem->data + memory->offset + offset, size);
+  copied_bytes += size;
+
+  return count_memory_new (memory->allocator, 0, NULL, data, size, 0, size);
+}
+
+static GstMemory *
+count_memory_share (GstMemory * memory, gssize offset, gssize size)
+{
+  CountMemory *mem = (CountMemory *) memory;
+  GstMemory *parent = memory->parent ? memory->parent : memory;
+
+  if (size == -1)
+    size = memory->size - offset;
+
+  return count_memory_new (memory->allocator,
+      GST_MINI_OBJECT_FLAGS (parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY,
+      parent, mem->data, memory->maxsize, memory->offset + offset, size);
+}
+
+static gboolean
+count_memory_is_span (GstMemory * mem1, GstMemory * mem2, gsize * offset)
+{
+  return FALSE;
+}
+
+static void
+count_allocator_class_init (CountAllocatorClass * klass)
+{
+  GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS (klass);
+
+  allocator_class->alloc = count_allocator_alloc;
+  allocator_class->free = count_allocator_free;
+}
+
+static void
+count_allocator_init (CountAllocator * allocator)
+{
+  GstAllocator *alloc = GST_ALLOCATOR_CAST (allocator);
+
+  alloc->mem_type = "CountMemory";
+  alloc->mem_map = count_memory_map;
+  alloc->mem_unmap = count_memory_unmap;
+  alloc->mem_copy = count_memory_copy;
+  alloc->mem_share = count_memory_share;
+  alloc->mem_is_span = count_memory_is_span;
+}
+
+/* test data */
+
+static guint8 *
+make_data (DataKind kind, gsize size)
+{
+  guint8 *data = g_malloc (size);
+  GRand *rand = g_rand_new_with_seed (size);
+  guint line = 0;
+  gsize i;
+
+  switch (kind) {
+    case DATA_RANDOM:
+      for (i = 0; i < size; i++)
+        data[i] = g_rand_int (rand);
+      break;
+    case DATA_TEXT:
+      for (i = 0; i < size;) {
+        gchar text[64];
+        gsize len = g_snprintf (text, sizeof (text),
+            "record %u of the test data, value %u\n", line++,
+            g_rand_int_range (rand, 0, 100000));
+
+        len = MIN (len, size - i);
+        memcpy (data + i, text, len);
+        i += len;
+      }
+      break;
+    default:
+      memset (data, 0, size);
+      break;
+  }
+  g_rand_free (rand);
+
+  return data;
+}
+
+/* deflate @data, @window_bits selects the gzip, zlib or raw format */
+static guint8 *
+deflate_data (const guint8 * data, gsize size, gint window_bits, gsize * out_size)
+{
+  z_stream strm = { 0, };
+  guint8 *out;
+  gsize bound;
+
+  fail_unless_equals_int (deflateInit2 (&strm, Z_DEFAULT_COMPRESSION,
+          Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY), Z_OK);
+  bound = deflateBound (&strm, size) + 32;
+  out = g_malloc (bound);
+
+  strm.next_in = (Bytef *) data;
+  strm.avail_in = size;
+  strm.next_out = out;
+  strm.avail_out = bound;
+  fail_unless_equals_int (deflate (&strm, Z_FINISH), Z_STREAM_END);
+  *out_size = strm.total_out;
+  deflateEnd (&strm);
+
+  return out;
+}
+
+static GstBuffer *
+wrap (const guint8 * data, gsize size)
+{
+  guint8 *copy = g_malloc (size);
+
+  memcpy (copy, data, size);
+  return gst_buffer_new_wrapped (copy, size);
+}
+
+/* push @data in buffers of @block bytes, returns how many were pushed */
+static guint
+push_blocks (GstHarness * h, const guint8 * data, gsize size, gsize block)
+{
+  guint n = 0;
+  gsize offset;
+
+  for (offset = 0; offset < size; offset += block, n++) {
+    fail_unless_equals_int (gst_harness_push (h, wrap (data + offset,
+                MIN (block, size - offset))), GST_FLOW_OK);
+  }
+
+  return n;
+}
+
+/* the decoded data, extracted without touching the memories */
+static GByteArray *
+pull_data (GstHarness * h, guint * n_buffers)
+{
+  GByteArray *out = g_byte_array_new ();
+  GstBuffer *buf;
+
+  *n_buffers = 0;
+  while ((buf = gst_harness_try_pull (h))) {
+    gsize len = out->len, size = gst_buffer_get_size (buf);
+
+    g_byte_array_set_size (out, len + size);
+    gst_buffer_extract (buf, 0, out->data + len, size);
+    gst_buffer_unref (buf);
+    (*n_buffers)++;
+  }
+
+  return out;
+}
+
+/* the titles of the tag events until EOS */
+static GPtrArray *
+pull_titles (GstHarness * h)
+{
+  GPtrArray *titles = g_ptr_array_new_with_free_func (g_free);
+  GstEvent *event;
+
+  while ((event = gst_harness_pull_event (h))) {
+    GstEventType type = GST_EVENT_TYPE (event);
+
+    if (type == GST_EVENT_TAG) {
+      GstTagList *tags;
+      gchar *title;
+
+      gst_event_parse_tag (event, &tags);
+      if (gst_tag_list_get_string (tags, GST_TAG_TITLE, &title))
+        g_ptr_array_add (titles, title);
+    }
+    gst_event_unref (event);
+    if (type == GST_EVENT_EOS)
+      break;
+  }
+
+  return titles;
+}
+
+static void
+check_data (GByteArray * out, const guint8 * data, gsize size)
+{
+  fail_unless_equals_uint64 (out->len, size);
+  fail_unless (memcmp (out->data, data, size) == 0);
+  g_byte_array_unref (out);
+}
+
+static void
+check_allocations (const guint8 * data, gsize size, const guint8 * cdata,
+    gsize csize, gsize block)
+{
+  GstHarness *h = gst_harness_new ("gzdec");
+  guint n_in, n_out, allocs;
+  gsize max_size, copied, reserved;
+  GByteArray *out;
+
+  gst_harness_set_src_caps_str (h, "application/x-gzip");
+
+  counters_reset ();
+  n_in = push_blocks (h, cdata, csize, block);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  allocs = n_allocs;
+  max_size = max_alloc_size;
+  copied = copied_bytes;
+  reserved = reserved_bytes;
+
+  out = pull_data (h, &n_out);
+  GST_INFO ("block %" G_GSIZE_FORMAT ": %u buffers in, %u out, %u allocs",
+      block, n_in, n_out, allocs);
+
+  /* one allocation per chunk, all but the last one filled up */
+  fail_unless (allocs <= size / CHUNK_SIZE + 1,
+      "%u allocations for %u input buffers", allocs, n_in);
+  fail_unless (reserved <= size + CHUNK_SIZE,
+      "%" G_GSIZE_FORMAT " bytes reserved for %" G_GSIZE_FORMAT " decoded",
+      reserved, size);
+  fail_unless (max_size <= CHUNK_SIZE,
+      "allocation of %" G_GSIZE_FORMAT " bytes, memories were merged",
+      max_size);
+  fail_unless (copied == 0, "%" G_GSIZE_FORMAT " bytes copied", copied);
+  /* a buffer holds as many chunks as it can without merging them */
+  fail_unless (n_out <= n_in + size / (gst_buffer_get_max_memory () *
+          CHUNK_SIZE) + 1, "%u buffers pushed for %u input buffers",
+      n_out, n_in);
+
+  check_data (out, data, size);
+  gst_harness_teardown (h);
+}
+
+GST_START_TEST (test_allocations)
+{
+  static const gsize block_sizes[] = { 7, 512, 4096, 65536 };
+  DataKind kind;
+  guint i;
+
+  for (kind = 0; kind < N_DATA_KINDS; kind++) {
+    guint8 *data = make_data (kind, DATA_SIZE);
+    guint8 *cdata;
+    gsize csize;
+
+    cdata = deflate_data (data, DATA_SIZE, MAX_WBITS + 16, &csize);
+    GST_INFO ("data kind %d, compressed to %" G_GSIZE_FORMAT " bytes", kind,
+        csize);
+    for (i = 0; i < G_N_ELEMENTS (block_sizes); i++)
+      check_allocations (data, DATA_SIZE, cdata, csize, block_sizes[i]);
+
+    g_free (cdata);
+    g_free (data);
+  }
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_zlib)
+{
+  guint8 *data = make_data (DATA_TEXT, DATA_SIZE);
+  GstHarness *h = gst_harness_new ("gzdec");
+  guint8 *cdata;
+  gsize csize;
+  guint n_out;
+
+  cdata = deflate_data (data, DATA_SIZE, MAX_WBITS, &csize);
+  gst_harness_set_src_caps_str (h, "application/x-gzip");
+  push_blocks (h, cdata, csize, 4096);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  check_data (pull_data (h, &n_out), data, DATA_SIZE);
+
+  gst_harness_teardown (h);
+  g_free (cdata);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+/* the decoded data cut on newlines, the last record is not delimited */
+static GByteArray *
+pull_records (GstHarness * h)
+{
+  GByteArray *out = g_byte_array_new ();
+  gboolean marker = TRUE, boundary = TRUE;
+  GstBuffer *buf;
+
+  while ((buf = gst_harness_try_pull (h))) {
+    gsize len = out->len, size = gst_buffer_get_size (buf);
+
+    g_byte_array_set_size (out, len + size);
+    gst_buffer_extract (buf, 0, out->data + len, size);
+    marker = GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_MARKER);
+    /* flagged buffers hold whole records, anything else is a piece of a
+     * single record */
+    if (marker) {
+      fail_unless (boundary);
+      fail_unless_equals_int (out->data[len + size - 1], '\n');
+    } else {
+      fail_unless (memchr (out->data + len, '\n', size - 1) == NULL);
+    }
+    boundary = out->data[len + size - 1] == '\n';
+    gst_buffer_unref (buf);
+  }
+  fail_if (marker);
+
+  return out;
+}
+
+GST_START_TEST (test_records)
+{
+  static const gsize block_sizes[] = { 7, 512, 65536 };
+  guint8 *data = make_data (DATA_TEXT, DATA_SIZE);
+  guint8 *cdata;
+  gsize csize;
+  guint i;
+
+  /* the last record is not delimited, and one is too long to be held in a
+   * buffer */
+  data[DATA_SIZE - 1] = 'x';
+  for (i = 300000; i < 700000; i++)
+    if (data[i] == '\n')
+      data[i] = ' ';
+  cdata = deflate_data (data, DATA_SIZE, MAX_WBITS + 16, &csize);
+
+  for (i = 0; i < G_N_ELEMENTS (block_sizes); i++) {
+    GstHarness *h = gst_harness_new ("gzdec");
+
+    g_object_set (h->element, "record-delimiter", '\n', NULL);
+    gst_harness_set_src_caps_str (h, "application/x-gzip");
+
+    counters_reset ();
+    push_blocks (h, cdata, csize, block_sizes[i]);
+    fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+    fail_unless (max_alloc_size <= CHUNK_SIZE);
+    fail_unless_equals_uint64 (copied_bytes, 0);
+
+    check_data (pull_records (h), data, DATA_SIZE);
+    gst_harness_teardown (h);
+  }
+
+  g_free (cdata);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+/* tar archives */
+
+static void
+tar_add (GByteArray * tar, const gchar * name, gchar type,
+    const guint8 * data, gsize size)
+{
+  static const guint8 zeros[512] = { 0, };
+  guint8 header[512] = { 0, };
+  guint checksum = 0;
+  gsize i;
+
+  memcpy (header, name, MIN (strlen (name), 100));
+  memcpy (header + 100, "0000644", 8);
+  g_snprintf ((gchar *) header + 124, 12, "%011" G_GINT64_MODIFIER "o",
+      (guint64) size);
+  header[156] = type;
+  memcpy (header + 257, "ustar", 6);
+  memcpy (header + 263, "00", 2);
+
+  memset (header + 148, ' ', 8);
+  for (i = 0; i < sizeof (header); i++)
+    checksum += header[i];
+  g_snprintf ((gchar *) header + 148, 8, "%06o", checksum);
+
+  g_byte_array_append (tar, header, sizeof (header));
+  g_byte_array_append (tar, data, size);
+  g_byte_array_append (tar, zeros, (512 - size % 512) % 512);
+}
+
+/* a pax extended header giving the path of the next entry */
+static void
+tar_add_pax_path (GByteArray * tar, const gchar * path)
+{
+  gsize len = strlen (" path=\n") + strlen (path);
+  gchar *record = NULL;
+
+  /* the length of a record counts its own digits */
+  do {
+    len = record ? strlen (record) : len + 1;
+    g_free (record);
+    record = g_strdup_printf ("%" G_GSIZE_FORMAT " path=%s\n", len, path);
+  } while (strlen (record) != len);
+
+  tar_add (tar, "PaxHeader/entry", 'x', (guint8 *) record, len);
+  g_free (record);
+}
+
+#define LONG_PATH "logs/a/directory/name/long/enough/to/need/a/pax/header/" \
+    "since/it/does/not/fit/the/one/hundred/bytes/of/ustar/names/b.log"
+
+static guint8 *
+make_tar (gboolean compress, gsize * size, GByteArray ** contents)
+{
+  static const guint8 zeros[1024] = { 0, };
+  GByteArray *tar = g_byte_array_new ();
+  guint8 *a = make_data (DATA_TEXT, 1000);
+  guint8 *b = make_data (DATA_RANDOM, 70000);
+  guint8 *c = make_data (DATA_TEXT, 512);
+  guint8 *data;
+
+  tar_add (tar, "a.txt", '0', a, 1000);
+  tar_add_pax_path (tar, LONG_PATH);
+  tar_add (tar, "b.log", '0', b, 70000);
+  tar_add (tar, "dir/", '5', NULL, 0);
+  tar_add (tar, "c.log", '0', c, 512);
+  g_byte_array_append (tar, zeros, sizeof (zeros));
+
+  contents[0] = g_byte_array_new_take (a, 1000);
+  contents[1] = g_byte_array_new_take (b, 70000);
+  contents[2] = g_byte_array_new_take (c, 512);
+
+  if (!compress) {
+    *size = tar->len;
+    return g_byte_array_free (tar, FALSE);
+  }
+
+  data = deflate_data (tar->data, tar->len, MAX_WBITS + 16, size);
+  g_byte_array_unref (tar);
+  return data;
+}
+
+static void
+check_tar (gboolean compress, const gchar * entry_filter,
+    const gchar ** titles, const guint * entries)
+{
+  GByteArray *contents[3], *expected = g_byte_array_new ();
+  GstHarness *h = gst_harness_new ("gzdec");
+  GPtrArray *found;
+  guint8 *cdata;
+  gsize csize;
+  guint i, n_out;
+
+  cdata = make_tar (compress, &csize, contents);
+  g_object_set (h->element, "tar", TRUE, "entry-filter", entry_filter,
+      "passthrough-uncompressed", !compress, NULL);
+  gst_harness_set_src_caps_str (h, "application/x-gzip");
+  push_blocks (h, cdata, csize, 1000);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+
+  found = pull_titles (h);
+  fail_unless_equals_int (found->len, g_strv_length ((gchar **) titles));
+  for (i = 0; i < found->len; i++) {
+    fail_unless_equals_string (g_ptr_array_index (found, i), titles[i]);
+    g_byte_array_append (expected, contents[entries[i]]->data,
+        contents[entries[i]]->len);
+  }
+
+  check_data (pull_data (h, &n_out), expected->data, expected->len);
+
+  gst_harness_teardown (h);
+  g_ptr_array_unref (found);
+  g_byte_array_unref (expected);
+  for (i = 0; i < G_N_ELEMENTS (contents); i++)
+    g_byte_array_unref (contents[i]);
+  g_free (cdata);
+}
+
+GST_START_TEST (test_tar)
+{
+  const gchar *titles[] = { "a.txt", LONG_PATH, "c.log", NULL };
+  const guint entries[] = { 0, 1, 2 };
+
+  check_tar (TRUE, NULL, titles, entries);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_tar_entry_filter)
+{
+  const gchar *titles[] = { LONG_PATH, "c.log", NULL };
+  const guint entries[] = { 1, 2 };
+
+  check_tar (TRUE, "*.log", titles, entries);
+}
+
+GST_END_TEST;
+
+/* zip archives */
+
+static void
+put_le (GByteArray * array, guint64 value, guint bytes)
+{
+  guint8 b[8];
+  guint i;
+
+  for (i = 0; i < bytes; i++)
+    b[i] = value >> (8 * i);
+  g_byte_array_append (array, b, bytes);
+}
+
+/* deflated entries have their sizes in a data descriptor, as written by
+ * streaming zip tools */
+static void
+zip_add (GByteArray * zip, GByteArray * directory, const gchar * name,
+    guint flags, guint method, const guint8 * data, gsize size)
+{
+  guint32 crc = crc32 (0, data, size);
+  guint64 offset = zip->len;
+  guint8 *cdata = NULL;
+  gsize csize = size;
+  gboolean descriptor = (method == Z_DEFLATED);
+
+  if (method == Z_DEFLATED)
+    cdata = deflate_data (data, size, -MAX_WBITS, &csize);
+  if (descriptor)
+    flags |= 1 << 3;
+
+  put_le (zip, 0x04034b50, 4);
+  put_le (zip, 20, 2);
+  put_le (zip, flags, 2);
+  put_le (zip, method, 2);
+  put_le (zip, 0, 4);
+  put_le (zip, descriptor ? 0 : crc, 4);
+  put_le (zip, descriptor ? 0 : csize, 4);
+  put_le (zip, descriptor ? 0 : size, 4);
+  put_le (zip, strlen (name), 2);
+  put_le (zip, 0, 2);
+  g_byte_array_append (zip, (const guint8 *) name, strlen (name));
+  g_byte_array_append (zip, cdata ? cdata : data, csize);
+  if (descriptor) {
+    put_le (zip, 0x08074b50, 4);
+    put_le (zip, crc, 4);
+    put_le (zip, csize, 4);
+    put_le (zip, size, 4);
+  }
+
+  put_le (directory, 0x02014b50, 4);
+  put_le (directory, 20, 2);
+  put_le (directory, 20, 2);
+  put_le (directory, flags, 2);
+  put_le (directory, method, 2);
+  put_le (directory, 0, 4);
+  put_le (directory, crc, 4);
+  put_le (directory, csize, 4);
+  put_le (directory, size, 4);
+  put_le (directory, strlen (name), 2);
+  put_le (directory, 0, 2);
+  put_le (directory, 0, 2);
+  put_le (directory, 0, 2);
+  put_le (directory, 0, 2);
+  put_le (directory, 0, 4);
+  put_le (directory, offset, 4);
+  g_byte_array_append (directory, (const guint8 *) name, strlen (name));
+
+  g_free (cdata);
+}
+
+/* "über.txt" in CP437, the zip default when the UTF-8 flag is not set */
+#define CP437_NAME "\x81" "ber.txt"
+#define UTF8_NAME "\xc3\xbc" "ber.txt"
+
+static GBytes *
+make_zip (GByteArray ** contents)
+{
+  GByteArray *zip = g_byte_array_new ();
+  GByteArray *directory = g_byte_array_new ();
+  guint8 *stored = make_data (DATA_TEXT, 3000);
+  guint8 *deflated = make_data (DATA_TEXT, 200000);
+  guint8 *cp437 = make_data (DATA_RANDOM, 100);
+  guint64 directory_offset;
+
+  zip_add (zip, directory, "stored.txt", 1 << 11, 0, stored, 3000);
+  zip_add (zip, directory, "deflate.txt", 1 << 11, Z_DEFLATED, deflated,
+      200000);
+  zip_add (zip, directory, CP437_NAME, 0, 0, cp437, 100);
+
+  directory_offset = zip->len;
+  g_byte_array_append (zip, directory->data, directory->len);
+  put_le (zip, 0x06054b50, 4);
+  put_le (zip, 0, 2);
+  put_le (zip, 0, 2);
+  put_le (zip, 3, 2);
+  put_le (zip, 3, 2);
+  put_le (zip, directory->len, 4);
+  put_le (zip, directory_offset, 4);
+  put_le (zip, 0, 2);
+  g_byte_array_unref (directory);
+
+  contents[0] = g_byte_array_new_take (stored, 3000);
+  contents[1] = g_byte_array_new_take (deflated, 200000);
+  contents[2] = g_byte_array_new_take (cp437, 100);
+
+  return g_byte_array_free_to_bytes (zip);
+}
+
+/* a src pad serving @bytes in seekable pull mode, like filesrc */
+static GstFlowReturn
+source_getrange (GstPad * pad, GstObject * parent, guint64 offset,
+    guint length, GstBuffer ** buffer)
+{
+  GBytes *bytes = g_object_get_data (G_OBJECT (pad), "bytes");
+  gsize size = g_bytes_get_size (bytes);
+
+  if (offset >= size)
+    return GST_FLOW_EOS;
+
+  *buffer = gst_buffer_new_wrapped_bytes (bytes);
+  gst_buffer_resize (*buffer, offset, MIN (length, size - offset));
+  GST_BUFFER_OFFSET (*buffer) = offset;
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+source_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  GBytes *bytes = g_object_get_data (G_OBJECT (pad), "bytes");
+  GstFormat format;
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_SCHEDULING:
+      gst_query_set_scheduling (query, GST_SCHEDULING_FLAG_SEEKABLE, 1, -1,
+          0);
+      gst_query_add_scheduling_mode (query, GST_PAD_MODE_PULL);
+      return TRUE;
+    case GST_QUERY_DURATION:
+      gst_query_parse_duration (query, &format, NULL);
+      if (format != GST_FORMAT_BYTES)
+        return FALSE;
+      gst_query_set_duration (query, format, g_bytes_get_size (bytes));
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+static GstPad *
+source_new (GBytes * bytes)
+{
+  GstPad *pad = gst_pad_new ("src", GST_PAD_SRC);
+
+  g_object_set_data_full (G_OBJECT (pad), "bytes", bytes,
+      (GDestroyNotify) g_bytes_unref);
+  gst_pad_set_getrange_function (pad, source_getrange);
+  gst_pad_set_query_function (pad, source_query);
+
+  return pad;
+}
+
+static void
+check_zip (gboolean pull, const gchar * entry_filter, const gchar * entry,
+    const gchar ** titles, const guint * entries)
+{
+  GByteArray *contents[3], *expected = g_byte_array_new ();
+  GBytes *zip = make_zip (contents);
+  GstPad *source = NULL;
+  GPtrArray *found;
+  GstHarness *h;
+  guint i, n_out;
+
+  if (pull) {
+    GstElement *element = gst_element_factory_make ("gzdec", NULL);
+    GstPad *sinkpad = gst_element_get_static_pad (element, "sink");
+
+    source = source_new (g_bytes_ref (zip));
+    fail_unless_equals_int (gst_pad_link (source, sinkpad), GST_PAD_LINK_OK);
+    gst_object_unref (sinkpad);
+    g_object_set (element, "entry-filter", entry_filter, "entry", entry, NULL);
+
+    h = gst_harness_new_with_element (element, NULL, "src");
+    gst_object_unref (element);
+    gst_harness_play (h);
+  } else {
+    h = gst_harness_new ("gzdec");
+    g_object_set (h->element, "entry-filter", entry_filter, "entry", entry,
+        NULL);
+    gst_harness_set_src_caps_str (h, "application/x-gzip");
+    push_blocks (h, g_bytes_get_data (zip, NULL), g_bytes_get_size (zip),
+        4096);
+    fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  }
+
+  found = pull_titles (h);
+  fail_unless_equals_int (found->len, g_strv_length ((gchar **) titles));
+  for (i = 0; i < found->len; i++) {
+    fail_unless_equals_string (g_ptr_array_index (found, i), titles[i]);
+    g_byte_array_append (expected, contents[entries[i]]->data,
+        contents[entries[i]]->len);
+  }
+
+  check_data (pull_data (h, &n_out), expected->data, expected->len);
+
+  gst_harness_teardown (h);
+  if (source)
+    gst_object_unref (source);
+  g_ptr_array_unref (found);
+  g_byte_array_unref (expected);
+  for (i = 0; i < G_N_ELEMENTS (contents); i++)
+    g_byte_array_unref (contents[i]);
+  g_bytes_unref (zip);
+}
+
+GST_START_TEST (test_zip)
+{
+  const gchar *titles[] = { "stored.txt", "deflate.txt", UTF8_NAME, NULL };
+  const guint entries[] = { 0, 1, 2 };
+
+  check_zip (FALSE, NULL, NULL, titles, entries);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_zip_entry_filter)
+{
+  const gchar *titles[] = { "deflate.txt", NULL };
+  const guint entries[] = { 1 };
+
+  check_zip (FALSE, "d*.txt", NULL, titles, entries);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_zip_entry)
+{
+  const gchar *titles[] = { "deflate.txt", NULL };
+  const guint entries[] = { 1 };
+
+  check_zip (FALSE, NULL, "deflate.txt", titles, entries);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_zip_pull)
+{
+  const gchar *titles[] = { "stored.txt", "deflate.txt", UTF8_NAME, NULL };
+  const guint entries[] = { 0, 1, 2 };
+
+  check_zip (TRUE, NULL, NULL, titles, entries);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_zip_pull_entry)
+{
+  const gchar *titles[] = { "deflate.txt", NULL };
+  const guint entries[] = { 1 };
+
+  check_zip (TRUE, NULL, "deflate.txt", titles, entries);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_memfd)
+{
+  static const gsize block_sizes[] = { 7, 65536 };
+  guint8 *data = make_data (DATA_TEXT, DATA_SIZE);
+  guint8 *cdata;
+  gsize csize;
+  guint i;
+
+  cdata = deflate_data (data, DATA_SIZE, MAX_WBITS + 16, &csize);
+
+  /* without memfd support the property is ignored, the data must be the
+   * same either way */
+  for (i = 0; i < G_N_ELEMENTS (block_sizes); i++) {
+    GstHarness *h = gst_harness_new ("gzdec");
+    guint n_out;
+
+    g_object_set (h->element, "memfd", TRUE, NULL);
+    gst_harness_set_src_caps_str (h, "application/x-gzip");
+    push_blocks (h, cdata, csize, block_sizes[i]);
+    fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+    check_data (pull_data (h, &n_out), data, DATA_SIZE);
+
+    gst_harness_teardown (h);
+  }
+
+  g_free (cdata);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+static void
+check_passthrough (const guint8 * input, gsize input_size,
+    const guint8 * data, gsize size)
+{
+  GstHarness *h = gst_harness_new ("gzdec");
+  guint n_out;
+
+  g_object_set (h->element, "passthrough-uncompressed", TRUE, NULL);
+  gst_harness_set_src_caps_str (h, "application/x-gzip");
+
+  counters_reset ();
+  push_blocks (h, input, input_size, 4096);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  fail_unless_equals_uint64 (copied_bytes, 0);
+  check_data (pull_data (h, &n_out), data, size);
+
+  gst_harness_teardown (h);
+}
+
+GST_START_TEST (test_passthrough)
+{
+  static const gchar *zlib_like[] = { "80", "x^", "(S" };
+  guint8 *data = make_data (DATA_TEXT, DATA_SIZE);
+  guint8 *cdata;
+  gsize csize;
+  guint i;
+
+  /* uncompressed input is forwarded untouched */
+  check_passthrough (data, DATA_SIZE, data, DATA_SIZE);
+
+  /* gzip and zlib streams are still decoded */
+  cdata = deflate_data (data, DATA_SIZE, MAX_WBITS + 16, &csize);
+  check_passthrough (cdata, csize, data, DATA_SIZE);
+  g_free (cdata);
+  cdata = deflate_data (data, DATA_SIZE, MAX_WBITS, &csize);
+  check_passthrough (cdata, csize, data, DATA_SIZE);
+  g_free (cdata);
+
+  /* text starting like a zlib header */
+  for (i = 0; i < G_N_ELEMENTS (zlib_like); i++) {
+    memcpy (data, zlib_like[i], 2);
+    check_passthrough (data, DATA_SIZE, data, DATA_SIZE);
+  }
+
+  g_free (data);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_passthrough_records)
+{
+  guint8 *data = make_data (DATA_TEXT, DATA_SIZE);
+  GstHarness *h = gst_harness_new ("gzdec");
+
+  /* uncompressed input is cut on records too */
+  data[DATA_SIZE - 1] = 'x';
+  g_object_set (h->element, "passthrough-uncompressed", TRUE,
+      "record-delimiter", '\n', NULL);
+  gst_harness_set_src_caps_str (h, "application/x-gzip");
+  push_blocks (h, data, DATA_SIZE, 4096);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  check_data (pull_records (h), data, DATA_SIZE);
+
+  gst_harness_teardown (h);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_passthrough_tar)
+{
+  const gchar *titles[] = { "a.txt", LONG_PATH, "c.log", NULL };
+  const guint entries[] = { 0, 1, 2 };
+
+  /* and demuxed */
+  check_tar (FALSE, NULL, titles, entries);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_caps)
+{
+  static const GstEventType order[] = { GST_EVENT_STREAM_START,
+    GST_EVENT_CAPS, GST_EVENT_SEGMENT, GST_EVENT_EOS
+  };
+  guint8 *data = make_data (DATA_TEXT, DATA_SIZE);
+  GstHarness *h = gst_harness_new ("gzdec");
+  guint8 *cdata;
+  gsize csize;
+  guint i, n_out;
+
+  cdata = deflate_data (data, DATA_SIZE, MAX_WBITS + 16, &csize);
+  gst_harness_set_src_caps_str (h, "application/x-gzip");
+  push_blocks (h, cdata, csize, 4096);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+
+  /* the sink caps are not proxied, the src caps are found from the decoded
+   * data and precede the segment */
+  for (i = 0; i < G_N_ELEMENTS (order); i++) {
+    GstEvent *event = gst_harness_pull_event (h);
+
+    fail_unless_equals_int (GST_EVENT_TYPE (event), order[i]);
+    if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+      GstCaps *caps;
+
+      gst_event_parse_caps (event, &caps);
+      fail_if (gst_structure_has_name (gst_caps_get_structure (caps, 0),
+              "application/x-gzip"));
+    }
+    gst_event_unref (event);
+  }
+  check_data (pull_data (h, &n_out), data, DATA_SIZE);
+
+  gst_harness_teardown (h);
+  g_free (cdata);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+/* zlib streams with a preset dictionary */
+
+#define DICTIONARY "record  of the test data, value \n"
+
+GST_START_TEST (test_dictionaries)
+{
+  guint8 *data = make_data (DATA_TEXT, DATA_SIZE);
+  GstHarness *h = gst_harness_new ("gzdec");
+  z_stream strm = { 0, };
+  gchar *path = NULL;
+  guint8 *cdata;
+  gsize bound;
+  guint n_out;
+  gint fd;
+
+  fail_unless_equals_int (deflateInit (&strm, Z_DEFAULT_COMPRESSION), Z_OK);
+  fail_unless_equals_int (deflateSetDictionary (&strm,
+          (const Bytef *) DICTIONARY, strlen (DICTIONARY)), Z_OK);
+  bound = deflateBound (&strm, DATA_SIZE);
+  cdata = g_malloc (bound);
+  strm.next_in = data;
+  strm.avail_in = DATA_SIZE;
+  strm.next_out = cdata;
+  strm.avail_out = bound;
+  fail_unless_equals_int (deflate (&strm, Z_FINISH), Z_STREAM_END);
+
+  fd = g_file_open_tmp ("gzdec-dictionary-XXXXXX", &path, NULL);
+  fail_unless (fd >= 0);
+  g_close (fd, NULL);
+  fail_unless (g_file_set_contents (path, DICTIONARY, -1, NULL));
+
+  g_object_set (h->element, "dictionaries", path, NULL);
+  gst_harness_set_src_caps_str (h, "application/x-gzip");
+  push_blocks (h, cdata, strm.total_out, 4096);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  check_data (pull_data (h, &n_out), data, DATA_SIZE);
+
+  gst_harness_teardown (h);
+  deflateEnd (&strm);
+  g_unlink (path);
+  g_free (path);
+  g_free (cdata);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+/* downstream pulling decoded ranges */
+
+typedef struct
+{
+  GstElement *element;
+  GstPad *source, *sink;
+} PullChain;
+
+static void
+pull_chain_setup (PullChain * chain, GBytes * bytes)
+{
+  GstPad *pad;
+
+  chain->element = gst_element_factory_make ("gzdec", NULL);
+  chain->source = source_new (bytes);
+  chain->sink = gst_pad_new ("sink", GST_PAD_SINK);
+
+  pad = gst_element_get_static_pad (chain->element, "sink");
+  fail_unless_equals_int (gst_pad_link (chain->source, pad), GST_PAD_LINK_OK);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (chain->element, "src");
+  fail_unless_equals_int (gst_pad_link (pad, chain->sink), GST_PAD_LINK_OK);
+  gst_object_unref (pad);
+}
+
+static void
+pull_chain_teardown (PullChain * chain)
+{
+  gst_pad_activate_mode (chain->sink, GST_PAD_MODE_PULL, FALSE);
+  gst_element_set_state (chain->element, GST_STATE_NULL);
+  gst_object_unref (chain->element);
+  gst_object_unref (chain->source);
+  gst_object_unref (chain->sink);
+}
+
+GST_START_TEST (test_getrange)
+{
+  /* enough to go past the first inflate checkpoint, every 4 MiB */
+  const gsize size = 6 << 20;
+  const guint64 offsets[] = { 0, 3 << 20, 100, size - 1000, 5000,
+    (4 << 20) + 10, size - 65536
+  };
+  guint8 *data = make_data (DATA_TEXT, size);
+  GstBuffer *buf = NULL;
+  PullChain chain;
+  GstQuery *query;
+  guint8 *cdata;
+  gsize csize;
+  guint i, j;
+
+  cdata = deflate_data (data, size, MAX_WBITS + 16, &csize);
+  pull_chain_setup (&chain, g_bytes_new_take (cdata, csize));
+
+  query = gst_query_new_scheduling ();
+  fail_unless (gst_pad_peer_query (chain.sink, query));
+  fail_unless (gst_query_has_scheduling_mode_with_flags (query,
+          GST_PAD_MODE_PULL, GST_SCHEDULING_FLAG_SEEKABLE));
+  gst_query_unref (query);
+
+  fail_unless (gst_pad_activate_mode (chain.sink, GST_PAD_MODE_PULL, TRUE));
+
+  counters_reset ();
+  for (i = 0; i < G_N_ELEMENTS (offsets); i++) {
+    guint8 range[65536];
+    gsize len;
+
+    fail_unless_equals_int (gst_pad_pull_range (chain.sink, offsets[i],
+            sizeof (range), &buf), GST_FLOW_OK);
+    len = gst_buffer_get_size (buf);
+    fail_unless_equals_uint64 (len, MIN (sizeof (range), size - offsets[i]));
+    fail_unless_equals_uint64 (GST_BUFFER_OFFSET (buf), offsets[i]);
+    gst_buffer_extract (buf, 0, range, len);
+    fail_unless (memcmp (range, data + offsets[i], len) == 0);
+    /* the ranges share the cached memories */
+    for (j = 0; j < gst_buffer_n_memory (buf); j++)
+      fail_unless (gst_memory_is_type (gst_buffer_peek_memory (buf, j),
+              "CountMemory"));
+    gst_clear_buffer (&buf);
+  }
+  fail_unless (max_alloc_size <= CHUNK_SIZE);
+  fail_unless_equals_uint64 (copied_bytes, 0);
+
+  fail_unless_equals_int (gst_pad_pull_range (chain.sink, size, 4096, &buf),
+      GST_FLOW_EOS);
+
+  pull_chain_teardown (&chain);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_getrange_zip)
+{
+  GByteArray *contents[3];
+  PullChain chain;
+  guint i;
+
+  /* a zip archive is not one decoded byte range */
+  pull_chain_setup (&chain, make_zip (contents));
+  fail_if (gst_pad_activate_mode (chain.sink, GST_PAD_MODE_PULL, TRUE));
+
+  pull_chain_teardown (&chain);
+  for (i = 0; i < G_N_ELEMENTS (contents); i++)
+    g_byte_array_unref (contents[i]);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_push_mode_seeking)
+{
+  guint8 *data = make_data (DATA_TEXT, DATA_SIZE);
+  GstHarness *h = gst_harness_new ("gzdec");
+  GstSchedulingFlags flags;
+  gboolean seekable;
+  GstQuery *query;
+  guint8 *cdata;
+  gsize csize;
+  gint64 position;
+
+  cdata = deflate_data (data, DATA_SIZE, MAX_WBITS + 16, &csize);
+  gst_harness_set_src_caps_str (h, "application/x-gzip");
+  push_blocks (h, cdata, csize, 65536);
+
+  /* positions are in decoded bytes, not in the compressed data */
+  fail_unless (gst_pad_peer_query_position (h->sinkpad, GST_FORMAT_BYTES,
+          &position));
+  fail_unless_equals_int64 (position, DATA_SIZE);
+
+  query = gst_query_new_seeking (GST_FORMAT_BYTES);
+  fail_unless (gst_pad_peer_query (h->sinkpad, query));
+  gst_query_parse_seeking (query, NULL, &seekable, NULL, NULL);
+  fail_if (seekable);
+  gst_query_unref (query);
+
+  query = gst_query_new_scheduling ();
+  fail_unless (gst_pad_peer_query (h->sinkpad, query));
+  gst_query_parse_scheduling (query, &flags, NULL, NULL, NULL);
+  fail_if (flags & GST_SCHEDULING_FLAG_SEEKABLE);
+  gst_query_unref (query);
+
+  fail_if (gst_harness_push_upstream_event (h, gst_event_new_seek (1.0,
+              GST_FORMAT_BYTES, GST_SEEK_FLAG_FLUSH, GST_SEEK_TYPE_SET, 0,
+              GST_SEEK_TYPE_NONE, -1)));
+
+  gst_harness_teardown (h);
+  g_free (cdata);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+static Suite *
+gzdec_suite (void)
+{
+  Suite *s = suite_create ("gzdec");
+  TCase *tc_chain = tcase_create ("general");
+  GstAllocator *allocator;
+
+  allocator = g_object_new (count_allocator_get_type (), NULL);
+  gst_allocator_set_default (gst_object_ref_sink (allocator));
+
+  tcase_set_timeout (tc_chain, 300);
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_allocations);
+  tcase_add_test (tc_chain, test_zlib);
+  tcase_add_test (tc_chain, test_records);
+  tcase_add_test (tc_chain, test_tar);
+  tcase_add_test (tc_chain, test_tar_entry_filter);
+  tcase_add_test (tc_chain, test_zip);
+  tcase_add_test (tc_chain, test_zip_entry_filter);
+  tcase_add_test (tc_chain, test_zip_entry);
+  tcase_add_test (tc_chain, test_zip_pull);
+  tcase_add_test (tc_chain, test_zip_pull_entry);
+  tcase_add_test (tc_chain, test_memfd);
+  tcase_add_test (tc_chain, test_passthrough);
+  tcase_add_test (tc_chain, test_passthrough_records);
+  tcase_add_test (tc_chain, test_passthrough_tar);
+  tcase_add_test (tc_chain, test_caps);
+  tcase_add_test (tc_chain, test_dictionaries);
+  tcase_add_test (tc_chain, test_getrange);
+  tcase_add_test (tc_chain, test_getrange_zip);
+  tcase_add_test (tc_chain, test_push_mode_seeking);
+
+  return s;
+}
+
+GST_CHECK_MAIN (gzdec);